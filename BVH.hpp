@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+typedef unsigned int U32;
+
+#define BVH_BINS 16 // SAH candidate splits per axis
+#define BVH_LEAF_SIZE 4 // max triangles per leaf
+#define BVH_PARALLEL_MIN 4096 // subtrees smaller than this build on one thread
+#define BVH_MAX_DEPTH 64 // traversal stack size; below depth BVH_MAX_DEPTH - 32 splits are by count
+
+// flattened node, 32 bytes. interior: first child is the next node, second
+// child at offset. leaf: count triangles starting at offset.
+class BVH_NODE {
+public:
+	float lo[3];
+	U32 offset;
+	float hi[3];
+	unsigned short count; // 0 = interior
+	unsigned short axis; // split axis, near child first along it
+};
+
+// bounding volume hierarchy over a world space triangle soup.
+class BVH {
+public:
+	vector<BVH_NODE> nodes;
+	vector<float> verts; // 9 floats per triangle, in leaf order
+	vector<U32> ids; // caller's triangle id per triangle, in leaf order
+	double build_ms = 0.0;
+	U32 builds = 0; // bumped by every build, lets users cache derived data
+
+	// tri_verts: 9 floats per triangle, tri_ids: one id per triangle.
+	void build(const vector<float>& tri_verts, const vector<U32>& tri_ids);
+	bool empty() { return nodes.empty(); }
+
+	// nearest hit along origin + t * dir, t in (0, t_max). returns the hit
+	// triangle's id (t_max = hit distance) or 0xFFFFFFFF.
+	U32 intersect(const float* origin, const float* dir, float& t_max);
+	// same for a packet of 4 rays sharing origin (e.g. a 2x2 pixel block),
+	// SSE over the rays. dirs: 4 x, 4 y, 4 z. t_max / hit: 4 each, in place.
+	void intersect4(const float* origin, const float* dirs, float* t_max, U32* hit);
+	// ids of triangles in boxes that pass all planes (n . p + d >= 0 inside,
+	// 4 floats per plane).
+	void cull(const float* planes, int num_planes, vector<U32>& out);
+
+private:
+	void cull_node(int n, const float* planes, int num_planes, bool inside, vector<U32>& out);
+};
@@ -3,11 +3,32 @@
 #include <vector>
 
 #include "V3.hpp"
+#include "M33.hpp"
+#include "BVH.hpp"
+#include "QuantizedMesh.hpp"
 
 #define COLOR(r,g,b) (((b) << 16) | ((g) << 8) | (r))
+#define max3(x, y, z) (max(max((x), (y)), (z)))
+#define min3(x, y, z) (min(min((x), (y)), (z)))
 
 typedef unsigned int U32;
 
+// visibility buffer ids: top 2 bits primitive type, low 30 bits index.
+#define VIS_NONE 0xFFFFFFFF
+#define VIS_SEGMENT 0
+#define VIS_SPHERE 1
+#define VIS_TRIANGLE 2
+#define VIS_MESH 3 // index = triangle index across all meshes and instances
+#define VIS_ID(type, i) (((U32)(type) << 30) | (U32)(i))
+#define VIS_TYPE(id) ((id) >> 30)
+#define VIS_INDEX(id) ((id) & 0x3FFFFFFF)
+
+// retained geometry: a handle is the VIS_ID of a GEOMETRY slot.
+#define GEO_MAX_PRIMITIVES 1000 // slots per primitive type
+#define GEO_ALIVE 1 // slot holds a primitive
+#define GEO_DIRTY 2 // changed since COMPUTED_GEOMETRY last projected it
+#define PROJECT_BATCH 64 // points a projection job gathers before projecting them
+
 class GEO_META {
 public:
 	U32 width;
@@ -46,14 +67,104 @@ public:
 	TRIANGLE(V3 (&points)[3], U32 color, U32 width);
 };
 
+class TEXTURE;
+
+// optional per vertex attributes of a projected mesh triangle.
+class TRI_ATTRIBS {
+public:
+	bool lit = false;
+	V3 cols[3]; // lit rgb (0..255)
+	TEXTURE* texture = 0;
+	float uv[6]; // texture coordinates, 2 per vertex
+	float q[3]; // 1 / depth per vertex, for perspective correct uv
+};
+
+// indexed triangle mesh, loaded from the geometry/*.bin format.
+class MESH {
+public:
+	int num_verts = 0;
+	int num_tris = 0;
+	V3* verts = 0;
+	V3* colors = 0; // optional, rgb in [0, 1]
+	V3* normals = 0; // optional
+	float* tcs = 0; // optional, 2 per vertex
+	U32* tris = 0; // 3 vertex indices per triangle
+	U32 color = COLOR(255, 255, 255);
+	TEXTURE* texture = 0; // applied with tcs when TEXTURE_MAPPING
+	bool dirty = true; // verts changed since the last projection
+
+	// level of detail chain (MESH_LODS), simplified copies from fine to coarse.
+	vector<MESH*> lods;
+	vector<float> lod_error; // per lod, worst rms quadric plane distance (object units)
+	MESH* base = 0; // set on lods, they share base's texture
+	V3 bound_center = V3(0.0f, 0.0f, 0.0f);
+	float bound_radius = 0.0f;
+	PACKED_MESH* packed = 0; // set by Pack, which frees verts / normals / colors / tris
+
+	MESH();
+	MESH(const char* fname);
+	~MESH();
+
+	void LoadBin(const char* fname);
+	// translate + scale so the bounding box is centered at center, largest side = size.
+	void Fit(V3 center, float size);
+	// QEM edge collapse lods, each level 1 / LOD_RATIO the triangles of the
+	// last, built concurrently. call after Fit / texture setup.
+	void BuildLods();
+	// spatial + vertex cache triangle order, vertices in first use order.
+	// prints ACMR before / after.
+	void Optimize();
+	// switch to PACKED_MESH storage (lods too). last step after loading.
+	void Pack();
+	// i-th entry of the index list / vertex i, plain or packed.
+	inline U32 index(int i);
+	inline V3 vertex(int i);
+};
+
+class NODE;
+class STREAMED_MESH;
+class TERRAIN;
+
+// a shared mesh drawn with its own rotation, translation and color tint.
+class INSTANCE {
+public:
+	MESH* mesh = 0;
+	NODE* node = 0; // rotation / translation are relative to node when set
+	M33 rotation = M33(1);
+	V3 translation = V3(0.0f, 0.0f, 0.0f);
+	U32 tint = COLOR(255, 255, 255); // multiplies the mesh (or vertex) colors
+	bool dirty = true; // transform / tint changed since the last projection
+
+	INSTANCE();
+	INSTANCE(MESH* mesh, M33 rotation, V3 translation, U32 tint);
+};
+
 class GEOMETRY {
 public:
 	int num_spheres = 0;
 	int num_segments = 0;
 	int num_triangles = 0;
-	SPHERE spheres[1000];
-	SEGMENT segments[1000];
-	TRIANGLE triangles[1000];
+	SPHERE spheres[GEO_MAX_PRIMITIVES];
+	SEGMENT segments[GEO_MAX_PRIMITIVES];
+	TRIANGLE triangles[GEO_MAX_PRIMITIVES];
+	vector<MESH*> meshes;
+	vector<INSTANCE> instances; // meshes here are owned by the caller
+	vector<STREAMED_MESH*> streams; // put their resident clusters in meshes each update
+	TERRAIN* terrain = 0; // puts its visible chunks in meshes each update
+
+	// slot state per VIS type (GEO_ALIVE | GEO_DIRTY), num_* are high water marks.
+	unsigned char flags[3][GEO_MAX_PRIMITIVES] = {};
+	NODE* slot_node[3][GEO_MAX_PRIMITIVES] = {}; // coordinates are local to this node when set
+	vector<U32> free_slots[3];
+	bool dirty_all = true; // reproject everything next update
+	bool meshes_changed = true; // mesh / instance list replaced, world space mesh data is stale
+
+	// retained handles of the pong / tetris scenes.
+	U32 pong_paddles[2][4];
+	U32 pong_ball;
+	NODE* pong_nodes[3] = {}; // player 1, player 2, ball
+	U32 tetris_cells[20][10][2];
+	bool tetris_shown[20][10];
 
 	// preloaded geometry (check function for details)
 	GEOMETRY();
@@ -62,13 +173,48 @@ public:
 
 	GEOMETRY(vector<SPHERE> spheres, vector<SEGMENT> segments, vector<TRIANGLE> triangles);
 
+	// build once, then update moves only what changed.
 	void setup_pong();
+	void update_pong(float alpha = 1.0f);
 	void setup_tetris();
+	void update_tetris();
 	void add_axis();
 
-	inline void add_segment(SEGMENT seg);
-	inline void add_sphere(SPHERE sph);
-	inline void add_triangle(TRIANGLE tri);
+	// add returns the new primitive's handle.
+	inline U32 add_segment(SEGMENT seg);
+	inline U32 add_sphere(SPHERE sph);
+	inline U32 add_triangle(TRIANGLE tri);
+	void add_mesh(MESH* mesh);
+	// returns the instance index.
+	int add_instance(INSTANCE inst);
+	void place_instance(int i, M33 rotation, V3 translation);
+	// move a primitive / instance into node's local space.
+	void attach(U32 handle, NODE* node);
+	void attach_instance(int i, NODE* node);
+
+	// edit by handle, each marks only that primitive dirty.
+	void move(U32 handle, V3 delta);
+	void recolor(U32 handle, U32 color);
+	void remove(U32 handle);
+	// replace, marks dirty only if anything differs.
+	void set_segment(U32 handle, SEGMENT seg);
+	void set_sphere(U32 handle, SPHERE sph);
+	void set_triangle(U32 handle, TRIANGLE tri);
+	inline bool alive(U32 handle);
+	inline void mark_dirty(U32 handle);
+	// remove every primitive (meshes stay).
+	void clear();
+
+private:
+	U32 new_slot(int type, int& count);
+};
+
+// points as separate x / y / z arrays.
+class PROJECTED_POINTS {
+public:
+	vector<float> x, y, z;
+	void resize(int n) { x.resize(n); y.resize(n); z.resize(n); }
+	V3 point(int i) { return V3(x[i], y[i], z[i]); }
 };
 
 class COMPUTED_GEOMETRY {
@@ -76,18 +222,78 @@ public:
 	int num_segments = 0;
 	int num_spheres = 0;
 	int num_triangles = 0;
-	SEGMENT segments[4000]; // transformed segs + triangle segs
-	SPHERE spheres[1000]; // transformed spheres
-	TRIANGLE triangles[1000];
+	// projected positions, same slots as GEOMETRY (2 / 1 / 3 points per slot).
+	// sized once for GEO_MAX_PRIMITIVES; color + width stay in GEOMETRY.
+	PROJECTED_POINTS segment_points;
+	PROJECTED_POINTS sphere_points;
+	PROJECTED_POINTS triangle_points;
+	// same slots as GEOMETRY, dead slots are skipped.
+	bool segment_alive[GEO_MAX_PRIMITIVES];
+	bool sphere_alive[GEO_MAX_PRIMITIVES];
+	bool triangle_alive[GEO_MAX_PRIMITIVES];
+
+	// projected mesh vertices, one range per mesh then one per instance,
+	// back to back. instances share their mesh's triangles.
+	vector<V3> mesh_points;
+	vector<int> mesh_vert_start; // first mesh_points entry per range
+	vector<int> mesh_tri_start; // first global triangle per range, + total at the end
+	vector<MESH*> mesh_source; // mesh per range
+	vector<int> mesh_instance; // instance index per range, -1 for plain meshes
+	vector<U32> mesh_color; // flat (tinted) color per range
+	vector<V3> mesh_lit; // lit rgb (0..255) per mesh_points entry, GOURAUD_SHADING only
+
+	// front to back draw order as VIS_IDs, filled when SORT_PRIMITIVES.
+	vector<U32> order;
+	double sort_ms = 0.0;
+
+	// retained state: what the last update projected for.
+	V3 camera[4]; // ppc a, b, c, C
+	int reprojected = 0; // primitives + mesh vertices projected by the last update
+
+	// world space hierarchy over all mesh triangles, rebuilt when a mesh or
+	// instance moves. ids are global mesh triangle indices.
+	BVH bvh;
+	bool bvh_stale = true;
+	vector<unsigned char> tri_visible; // per mesh triangle, filled when BVH_CULLING
+	vector<unsigned char> range_stale; // per range, points not projected since it was culled
+	int culled = 0; // mesh triangles outside the frustum
 
 	COMPUTED_GEOMETRY();
 
+	// reproject dirty GEOMETRY slots and meshes (everything when the camera moved).
 	void recompute_geometry();
+	bool camera_moved();
+	// radix sort all primitives by projected min depth.
+	void sort_front_to_back();
+
+	// project n points given as x / y / z arrays, 4 at a time.
+	void project_points(const float* x, const float* y, const float* z, int n, float* ox, float* oy, float* oz);
+	// project n vertices, under rotation r + translation t when r is given.
+	void project_vertices(V3* in, int n, V3* out, M33* r = 0, V3* t = 0);
+	// projected slot i with its GEOMETRY color / width.
+	inline SEGMENT segment(int i);
+	inline SPHERE sphere(int i);
+	inline TRIANGLE triangle(int i);
+
+	// per vertex directional lighting over every mesh vertex, 4 at a time.
+	void light_meshes();
+	// (re)build the range tables for the current meshes + instances.
+	void build_mesh_ranges();
 
-	// rotate and translate point based on perspective and origin.
-	inline V3& transform(V3& v3);
+	// projected triangle t (global index over all meshes). attr (optional)
+	// receives lit colors / texture coordinates, returns whether there are any.
+	bool mesh_triangle(U32 t, TRIANGLE& tri, TRI_ATTRIBS* attr = 0);
 
-	inline void add_segment(SEGMENT& seg);
-	inline void add_sphere(SPHERE& sph);
-	inline void add_triangle(TRIANGLE& tri);
+	// world space triangle soup of every range (9 floats each).
+	void world_triangles(vector<float>& verts, vector<U32>& ids);
+	void update_bvh();
+	// project a packed mesh's vertices under rotation r + translation t.
+	void project_packed(PACKED_MESH& packed, M33& r, V3& t, V3* out);
+	// flag mesh triangles whose BVH leaves intersect the view frustum.
+	void cull_meshes();
+	// mesh triangle under pixel (u, v), 0xFFFFFFFF if none.
+	U32 pick(float u, float v);
+	// coarsest lod of mesh (drawn by instance k, -1 for none) whose error
+	// projects under LOD_PIXEL_ERROR pixels.
+	MESH* select_lod(MESH* mesh, int k);
 };
\ No newline at end of file
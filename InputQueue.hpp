@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+#define INPUT_QUEUE_SIZE 256 // key events buffered between the FLTK handler and the simulation tick (power of 2)
+
+// one key press, stamped when FLTK delivered it.
+class INPUT_EVENT {
+public:
+	int key = 0;
+	chrono::high_resolution_clock::time_point time;
+};
+
+// lock free ring for exactly one producer thread and one consumer thread.
+// head and tail only ever grow (wrapping), each is written by one side;
+// the release / acquire pair publishes the slot before the index moves.
+template <typename T, unsigned int N>
+class SPSC_QUEUE {
+public:
+	atomic<unsigned int> dropped; // pushes refused because the ring was full
+
+	SPSC_QUEUE() : dropped(0), head(0), tail(0) {}
+
+	// producer side, false (and the event is lost) when full.
+	bool push(const T& item) {
+		const unsigned int t = tail.load(memory_order_relaxed);
+		if (t - head.load(memory_order_acquire) == N) {
+			dropped.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+		items[t & (N - 1)] = item;
+		tail.store(t + 1, memory_order_release);
+		return true;
+	}
+
+	// consumer side, false when empty.
+	bool pop(T& item) {
+		const unsigned int h = head.load(memory_order_relaxed);
+		if (h == tail.load(memory_order_acquire)) return false;
+		item = items[h & (N - 1)];
+		head.store(h + 1, memory_order_release);
+		return true;
+	}
+
+private:
+	static_assert((N & (N - 1)) == 0, "SPSC_QUEUE size must be a power of 2");
+	T items[N];
+	// each index on its own cache line, the two threads don't share writes.
+	char pad0[64];
+	atomic<unsigned int> head;
+	char pad1[64];
+	atomic<unsigned int> tail;
+	char pad2[64];
+};
+
+// input latency (delivery to simulation) over the ticks since the last reset,
+// and the key events that never reached a tick.
+class INPUT_STATS {
+public:
+	unsigned int events = 0;
+	unsigned int dropped = 0; // the queue was full
+	unsigned int discarded = 0; // pressed before the simulation started ticking
+	double total_ms = 0.0;
+	double max_ms = 0.0;
+
+	double average_ms() {
+		return events ? total_ms / events : 0.0;
+	}
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Geometry.hpp"
+
+#define VCACHE_SIZE 32 // lru cache modelled by the Forsyth scoring
+#define ACMR_CACHE_SIZE 16 // fifo cache used to report ACMR
+
+// average cache miss ratio: vertices transformed per triangle with a
+// cache_size fifo post transform cache (0.5 ideal, 3 worst).
+float mesh_acmr(MESH& mesh, int cache_size = ACMR_CACHE_SIZE);
+// triangle indices along a 3D Morton curve of their centroids.
+void spatial_order(MESH& mesh, vector<int>& order);
+// triangles in spatial_order, coherent clusters for the reorder below to
+// start from.
+void sort_triangles_spatially(MESH& mesh);
+// Forsyth's greedy reorder: repeatedly emit the best scoring triangle among
+// those using cached vertices.
+void optimize_vertex_cache(MESH& mesh);
+// renumber vertices (and their attributes) in order of first use.
+void optimize_vertex_fetch(MESH& mesh);
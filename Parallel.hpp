@@ -0,0 +1,116 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+using namespace std;
+
+#define JOB_SPLITS 4 // parallel_for / parallel_reduce pieces per thread, spare pieces get stolen
+
+// counters since the last reset_stats.
+class JOB_STATS {
+public:
+	unsigned int tasks = 0; // jobs run
+	unsigned int steals = 0; // jobs taken from another thread's deque
+	double idle_ms = 0.0; // summed over threads, time with nothing to run while jobs were pending
+};
+
+// fixed pool of hardware_concurrency() - 1 workers plus whichever thread
+// waits. every worker owns a deque: it pushes and pops at the back, idle
+// threads steal from the front of the others. waiting threads run jobs
+// instead of blocking, so jobs can spawn and wait on jobs.
+class JOB_SYSTEM {
+public:
+	JOB_SYSTEM();
+	~JOB_SYSTEM();
+	// threads that run jobs, the waiting caller included.
+	int threads() { return (int)workers.size() + 1; }
+	// queue fn on the calling thread's deque, pending counts it until it ran.
+	void push(atomic<int>& pending, function<void()> fn);
+	// run or steal jobs until pending reaches 0.
+	void wait(atomic<int>& pending);
+	JOB_STATS stats();
+	void reset_stats();
+
+private:
+	class JOB {
+	public:
+		function<void()> fn;
+		atomic<int>* pending;
+	};
+	class JOB_QUEUE {
+	public:
+		mutex lock;
+		deque<JOB> jobs;
+	};
+	vector<thread> workers;
+	vector<JOB_QUEUE*> queues; // 0 is shared by threads outside the pool
+	atomic<int> queued;
+	atomic<int> in_flight; // pushed, not finished
+	atomic<bool> quit;
+	mutex sleep_lock;
+	condition_variable wake;
+	atomic<unsigned int> tasks, steals;
+	atomic<long long> idle_us;
+
+	bool run_one(int self);
+	void worker_main(int self);
+};
+
+JOB_SYSTEM& job_system();
+
+// split [begin, end) into contiguous pieces, fn(lo, hi) once per piece.
+// pieces run as jobs, the calling thread takes the first and then helps.
+template <typename F>
+inline void parallel_for(int begin, int end, F fn) {
+	const int n = end - begin;
+	if (n <= 0) return;
+	JOB_SYSTEM& jobs = job_system();
+	const int pieces = min(n, jobs.threads() * JOB_SPLITS);
+	if (pieces <= 1) {
+		fn(begin, end);
+		return;
+	}
+	const int chunk = (n + pieces - 1) / pieces;
+	atomic<int> pending(0);
+	for (int lo = begin + chunk; lo < end; lo += chunk) {
+		const int hi = min(lo + chunk, end);
+		jobs.push(pending, [&fn, lo, hi] { fn(lo, hi); });
+	}
+	fn(begin, min(begin + chunk, end));
+	jobs.wait(pending);
+}
+
+// fn(lo, hi) -> T per piece as in parallel_for, results folded in range
+// order with combine starting from identity.
+template <typename T, typename F, typename C>
+inline T parallel_reduce(int begin, int end, T identity, F fn, C combine) {
+	const int n = end - begin;
+	if (n <= 0) return identity;
+	const int pieces = min(n, job_system().threads() * JOB_SPLITS);
+	const int chunk = (n + pieces - 1) / pieces;
+	vector<T> partial((n + chunk - 1) / chunk, identity);
+	parallel_for(0, (int)partial.size(), [&](int lo, int hi) {
+		for (int p = lo; p < hi; p++) partial[p] = fn(begin + p * chunk, min(begin + (p + 1) * chunk, end));
+	});
+	T result = identity;
+	for (T& value : partial) result = combine(result, value);
+	return result;
+}
+
+// run a and b concurrently (a as a job, b on the calling thread), for
+// recursive splits.
+template <typename A, typename B>
+inline void parallel_invoke(A a, B b) {
+	JOB_SYSTEM& jobs = job_system();
+	atomic<int> pending(0);
+	jobs.push(pending, [&a] { a(); });
+	b();
+	jobs.wait(pending);
+}
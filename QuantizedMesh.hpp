@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "V3.hpp"
+
+using namespace std;
+
+typedef unsigned int U32;
+
+#define PACKED_BLOCK 32 // triangles per index block (one 32 bit base, 16 bit offsets)
+
+// compact storage of a MESH: 16 bit positions over the bounding box (SoA, so
+// 4 decode with one SSE load), octahedral normals in 2 x 16 bits, 8 bit
+// colors and indices as 16 bit offsets from a per block base.
+class PACKED_MESH {
+public:
+	int num_verts = 0;
+	int num_tris = 0;
+	int stride = 0; // num_verts rounded up to 4, offset of y / z in pos
+	vector<unsigned short> pos; // x[stride] y[stride] z[stride]
+	float lo[3], scale[3]; // position = lo + q * scale
+	vector<U32> normals; // octahedral, u | v << 16
+	vector<U32> colors; // rgb, COLOR() layout
+	vector<U32> block_base; // first index of each PACKED_BLOCK triangles
+	vector<unsigned short> offsets; // 3 per triangle, index - block base
+	vector<U32> wide_tris; // plain indices when a block spans more than 16 bits
+
+	inline U32 index(int i);
+	inline V3 position(int i);
+	inline V3 normal(int i);
+	inline V3 color(int i);
+	size_t bytes();
+};
+
+// octahedral normal encoding, 16 bits per component.
+U32 oct_encode(V3& n);
+V3 oct_decode(U32 e);
@@ -0,0 +1,11 @@
+#pragma once
+
+typedef unsigned int U32;
+
+// map a float to a U32 whose unsigned order matches the float order.
+inline U32 float_to_key(float f);
+
+// stable LSD radix sort of vals by 32 bit keys, 8 bits per pass.
+// tmp_keys / tmp_vals must hold n elements, result ends up in keys / vals.
+// large inputs are histogrammed and scattered in parallel chunks.
+void radix_sort(U32* keys, U32* vals, U32* tmp_keys, U32* tmp_vals, int n);
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+#include "framebuffer.h"
+
+using namespace std;
+
+#define BENCHMARK_FRAMES 50
+
+// time full frames (clear + applyGeometry) of the current scene.
+double benchmark_frames(FrameBuffer* fb) {
+	using chrono::high_resolution_clock;
+	auto t1 = high_resolution_clock::now();
+	for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+		fb->SetBGR(0);
+		fb->applyGeometry();
+	}
+	auto t2 = high_resolution_clock::now();
+	return chrono::duration<double, milli>(t2 - t1).count() / BENCHMARK_FRAMES;
+}
+
+// frame time and framebuffer memory for each MSAA sample count.
+void benchmark_msaa(FrameBuffer* fb) {
+	const int old_samples = fb->msaa;
+	const int modes[] = { 1, 2, 4, 8 };
+	for (int samples : modes) {
+		fb->setMSAA(samples);
+		double ms = benchmark_frames(fb);
+		cout << "MSAA " << samples << "x: "
+			<< ms << " ms/frame, "
+			<< 1000.0 / ms << " fps, "
+			<< fb->memoryBytes() / (1024.0 * 1024.0) << " MB\n";
+	}
+	fb->setMSAA(old_samples);
+}
+
+// mesh throughput with and without the small triangle path.
+void benchmark_small_triangles(FrameBuffer* fb) {
+	const bool old_path = fb->small_tri_path;
+	for (int on = 0; on < 2; on++) {
+		fb->small_tri_path = on;
+		double ms = benchmark_frames(fb);
+		const int tris = fb->compute.mesh_tri_start.back() + fb->compute.num_triangles;
+		cout << "small triangle path " << (on ? "on: " : "off: ")
+			<< ms << " ms/frame, "
+			<< tris / ms * 1e-3 << " M tris/s, "
+			<< fb->stats.small_triangles << " small\n";
+	}
+	fb->small_tri_path = old_path;
+}
+
+// an unchanged scene through renderDirty (after one full frame) vs full frames.
+void benchmark_dirty_rects(FrameBuffer* fb) {
+	using chrono::high_resolution_clock;
+	fb->renderDirty(0);
+	auto t1 = high_resolution_clock::now();
+	for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+		fb->renderDirty(0);
+	}
+	auto t2 = high_resolution_clock::now();
+	double idle_ms = chrono::duration<double, milli>(t2 - t1).count() / BENCHMARK_FRAMES;
+	cout << "dirty rects, idle: " << idle_ms << " ms/frame, full: "
+		<< benchmark_frames(fb) << " ms/frame\n";
+}
+
+// reprojection of every instance (all dirty), shared mesh vs unshared copies.
+void benchmark_instances(FrameBuffer* fb) {
+	GEOMETRY& geometry = scene->geometry;
+	if (geometry.instances.empty()) return;
+	using chrono::high_resolution_clock;
+	size_t verts = 0, mesh_bytes = 0;
+	for (INSTANCE& inst : geometry.instances) verts += inst.mesh->num_verts;
+	MESH* mesh = geometry.instances[0].mesh;
+	mesh_bytes = mesh->packed ? mesh->packed->bytes() : mesh->num_verts * sizeof(V3) + mesh->num_tris * 3 * sizeof(U32);
+
+	auto t1 = high_resolution_clock::now();
+	for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+		for (INSTANCE& inst : geometry.instances) inst.dirty = true;
+		fb->compute.recompute_geometry();
+	}
+	auto t2 = high_resolution_clock::now();
+	double ms = chrono::duration<double, milli>(t2 - t1).count() / BENCHMARK_FRAMES;
+	cout << geometry.instances.size() << " instances: " << ms << " ms to reproject, "
+		<< verts / ms * 1e-3 << " M verts/s, source "
+		<< (mesh_bytes + geometry.instances.size() * sizeof(INSTANCE)) / 1024.0 << " KB vs "
+		<< mesh_bytes * geometry.instances.size() / 1024.0 << " KB as copies\n";
+}
+
+// rasterizer vs ray tracer on each mesh alone, in place of the scene's meshes.
+void benchmark_ray_trace(FrameBuffer* fb) {
+	const char* files[] = {
+		"geometry/teapot1K.bin", "geometry/bunny.bin", "geometry/teapot57K.bin",
+		"geometry/car.bin", "geometry/tree1.bin", "geometry/happy4.bin", "geometry/terrain.bin"
+	};
+	GEOMETRY& geometry = scene->geometry;
+	vector<MESH*> old_meshes = geometry.meshes;
+	vector<INSTANCE> old_instances = geometry.instances;
+	const bool old_trace = fb->ray_trace;
+	geometry.instances.clear();
+	for (const char* file : files) {
+		MESH* mesh = new MESH(file);
+		if (!mesh->num_tris) {
+			delete mesh;
+			continue;
+		}
+		mesh->Fit(V3(0.0f, 0.0f, -400.0f), 300.0f);
+		geometry.meshes = { mesh };
+		geometry.dirty_all = geometry.meshes_changed = true;
+		cout << file << " (" << mesh->num_tris << " tris): ";
+		for (int trace = 0; trace < 2; trace++) {
+			fb->ray_trace = trace;
+			const double ms = benchmark_frames(fb);
+			cout << (trace ? ", ray trace " : "raster ") << ms << " ms/frame";
+		}
+		cout << " (bvh build " << fb->compute.bvh.build_ms << " ms)\n";
+		geometry.meshes.clear();
+		geometry.dirty_all = geometry.meshes_changed = true;
+		fb->compute.recompute_geometry();
+		delete mesh;
+	}
+	fb->ray_trace = old_trace;
+	geometry.meshes = old_meshes;
+	geometry.instances = old_instances;
+	geometry.dirty_all = geometry.meshes_changed = true;
+}
+
+// depth only light pass vs a full color frame of the same meshes.
+void benchmark_shadows(FrameBuffer* fb) {
+	if (fb->compute.mesh_source.empty()) return;
+	fb->renderShadowMap();
+	double depth_ms = 0.0;
+	for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+		fb->shadow->invalidate();
+		fb->renderShadowMap();
+		depth_ms += fb->stats.shadow_ms;
+	}
+	depth_ms /= BENCHMARK_FRAMES;
+	const int size = fb->shadow->size;
+	cout << "shadow map " << size << "x" << size << ": " << depth_ms << " ms depth only ("
+		<< fb->shadow->triangles << " tris), color frame " << benchmark_frames(fb) << " ms\n";
+
+	// the map depends on casters + light only, a camera move has to reuse it.
+	PPC saved = *scene->ppc;
+	V3 step = V3(5.0f, 0.0f, 0.0f);
+	scene->ppc->C += step;
+	fb->compute.recompute_geometry();
+	const bool rendered = fb->renderShadowMap();
+	*scene->ppc = saved;
+	fb->compute.recompute_geometry();
+	cout << "shadow map after a camera move: " << (rendered ? "RE-RENDERED (should be reused)" : "reused") << "\n";
+}
+
+#define TEXTURE_FETCHES (1 << 22)
+
+// ns per filtered fetch over random uvs and mip levels.
+void benchmark_texture() {
+	TEXTURE tex;
+	if (!tex.LoadTiff(TEXTURE_FILE)) return;
+	vector<float> uvl(3 * 4096);
+	srand(1);
+	for (size_t i = 0; i < uvl.size(); i += 3) {
+		uvl[i] = (float)rand() / RAND_MAX * tex.size;
+		uvl[i + 1] = (float)rand() / RAND_MAX * tex.size;
+		uvl[i + 2] = (float)rand() / RAND_MAX * (tex.levels - 1);
+	}
+	using chrono::high_resolution_clock;
+	for (int tri = 0; tri < 2; tri++) {
+		U32 sum = 0;
+		auto t1 = high_resolution_clock::now();
+		for (int i = 0; i < TEXTURE_FETCHES; i++) {
+			const float* s = &uvl[(i % 4096) * 3];
+			sum += tri ? tex.SampleTrilinear(s[0], s[1], s[2]) : tex.SampleBilinear(s[0], s[1], (int)s[2]);
+		}
+		auto t2 = high_resolution_clock::now();
+		double ns = chrono::duration<double, nano>(t2 - t1).count() / TEXTURE_FETCHES;
+		cout << (tri ? "trilinear: " : "bilinear: ") << ns << " ns/fetch"
+			<< " (" << sum % 2 << ")\n";
+	}
+}
+
+#define TETRIS_BENCH_PIECES 1000000
+
+// automated random play on the bitboard tetris: piece moves per second.
+void benchmark_tetris() {
+	TETRIS game;
+	RNG rng;
+	rng.seed(SIM_SEED);
+	unsigned int lines = 0, games_over = 0;
+	auto t1 = chrono::high_resolution_clock::now();
+	for (int i = 0; i < TETRIS_BENCH_PIECES; i++) {
+		if (!game.spawn(rng.below(TETRIS_SHAPES))) {
+			games_over++;
+			continue;
+		}
+		for (int r = rng.below(4); r > 0; r--) game.rotate();
+		const int dx = rng.below(TETRIS_COLS) - game.col;
+		for (int k = 0; k < abs(dx); k++) game.move(dx > 0 ? 1 : -1);
+		const int before = game.score;
+		while (game.drop()) {}
+		lines += game.score - before;
+	}
+	auto t2 = chrono::high_resolution_clock::now();
+	const double s = chrono::duration<double>(t2 - t1).count();
+	cout << "tetris: " << game.moves / s / 1e6 << " M moves/s (" << TETRIS_BENCH_PIECES << " pieces, "
+		<< lines << " lines, " << games_over << " games over)\n";
+}
+
+void benchmark_render(FrameBuffer* fb) {
+	cout << "---- render benchmarks ----\n";
+	benchmark_msaa(fb);
+	benchmark_small_triangles(fb);
+	benchmark_dirty_rects(fb);
+	benchmark_instances(fb);
+	benchmark_ray_trace(fb);
+	benchmark_shadows(fb);
+	benchmark_texture();
+	benchmark_tetris();
+	fb->SetBGR(0);
+	fb->applyGeometry();
+	fb->redraw();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include "V3.hpp"
+#include "M33.hpp"
+
+using namespace std;
+
+typedef unsigned int U32;
+
+// transform hierarchy node. primitives / instances attached to a node are
+// stored in its local space, world = parent world * local, cached.
+class NODE {
+public:
+	NODE* parent = 0;
+	vector<NODE*> children;
+	M33 rotation = M33(1); // local, relative to parent
+	V3 translation = V3(0.0f, 0.0f, 0.0f);
+	M33 world_rotation = M33(1); // cached
+	V3 world_translation = V3(0.0f, 0.0f, 0.0f);
+	bool dirty = true; // local changed, world of this subtree is stale
+	vector<U32> handles; // attached GEOMETRY primitives
+	vector<int> instances; // attached GEOMETRY instances
+
+	NODE();
+	~NODE();
+
+	NODE* add_child();
+	// mark dirty only if the value differs.
+	void set_rotation(M33 r);
+	void set_translation(V3 t);
+
+	// local point -> world.
+	inline V3 to_world(V3& p);
+	// recompute world transforms of dirty subtrees and mark what hangs off
+	// them dirty. untouched subtrees cost one flag test per node.
+	void update(bool parent_moved = false);
+};
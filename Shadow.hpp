@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+#include "V3.hpp"
+#include "M33.hpp"
+#include "ppc.h"
+#include "BVH.hpp"
+
+using namespace std;
+
+#define SHADOW_MAP_SIZE 1024 // light depth map resolution, multiple of 4
+#define SHADOW_FOV 40.0f // light camera hfov, the casters' bounding sphere fits at 3 radii
+#define SHADOW_BIAS 0.005f // relative depth slack against self shadowing
+#define SHADOW_PCF 1 // (2 * SHADOW_PCF + 1)^2 taps per lookup
+
+// depth map rendered from a PPC placed at the light, looked up with PCF.
+class SHADOW_MAP {
+public:
+	PPC* ppc; // light camera, re-aimed at the casters on every render
+	int size;
+	vector<float> depth; // 1 / light z of the nearest caster per texel, 0 = none
+	double render_ms = 0.0; // last depth pass, 0 when it was skipped
+	U32 triangles = 0; // rasterized by the last depth pass
+
+	SHADOW_MAP(int _size);
+	~SHADOW_MAP();
+
+	// depth only pass over the BVH's world space triangles, along light_dir.
+	// skipped (returns false) when neither the casters nor the light changed.
+	bool render(BVH& casters, V3 light_dir);
+	// fraction of taps around world point p that see the light.
+	float lookup(V3& p);
+	// force the next render.
+	void invalidate() { rendered_build = 0xFFFFFFFF; }
+
+private:
+	U32 rendered_build = 0xFFFFFFFF; // casters.builds of the last render, bumped only when caster world data changes
+	V3 rendered_light;
+
+	void rasterDepth(V3* p);
+};
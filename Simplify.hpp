@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Geometry.hpp"
+
+#define LOD_MAX_LEVELS 6 // lods per mesh, besides the mesh itself
+#define LOD_RATIO 4 // triangles of a level / triangles of the next
+#define LOD_MIN_TRIS 200 // no level below this
+#define LOD_PIXEL_ERROR 1.0f // selection: max projected simplification error (px)
+#define LOD_BOUNDARY_WEIGHT 10.0f // quadric weight of planes keeping open borders in place
+
+// symmetric 4x4 plane quadric, sum of squared distances to its planes.
+class QUADRIC {
+public:
+	double q[10] = {}; // aa ab ac ad bb bc bd cc cd dd
+	double weight = 0.0; // sum of plane weights
+
+	void add_plane(double a, double b, double c, double d, double w);
+	void operator+=(const QUADRIC& o);
+	double error(V3& v) const;
+	// root mean square distance of v to the planes.
+	double distance(V3& v) const;
+};
+
+// edge collapse simplification of src down to about target triangles. out
+// gets the surviving vertices (with their attributes) and triangles, the
+// return value is the largest collapse error as an rms plane distance.
+float simplify_mesh(MESH& src, int target, MESH& out);
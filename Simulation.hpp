@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+#define SIM_HZ 30 // fixed simulation ticks per second
+#define SIM_MAX_TICKS 8 // ticks one frame may run to catch up, the rest of a longer stall is dropped
+#define SIM_SEED 334 // PRNG seed of a new session
+#define INPUT_LOG_MAGIC 0x4C504E49 // "INPL"
+#define INPUT_LOG_VERSION 1
+
+class FrameBuffer;
+
+// xorshift64*, the same sequence for a seed on every platform and build.
+class RNG {
+public:
+	unsigned long long state = 1;
+
+	void seed(unsigned long long s) { state = s ? s : 1; }
+	unsigned int next() {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return (unsigned int)((state * 2685821657736338717ULL) >> 32);
+	}
+	// uniform enough in [0, n) for small n.
+	int below(int n) { return (int)(next() % (unsigned int)n); }
+};
+
+// every key a session applied, with the tick it was applied on. the seed
+// plus the keys replay the session exactly; hash is Scene::state_hash after
+// ticks, to check the replay against.
+class INPUT_LOG {
+public:
+	unsigned long long seed = SIM_SEED;
+	unsigned int ticks = 0;
+	unsigned long long hash = 0;
+	vector<unsigned int> key_ticks;
+	vector<int> keys;
+
+	bool save(const char* fname);
+	bool load(const char* fname);
+};
+
+// fixed timestep driver for the scene's games. real time accumulates and is
+// consumed in ticks of 1 / SIM_HZ s; rendering interpolates by alpha between
+// the last two ticks. keys are applied at the start of a tick, from the
+// FrameBuffer's input queue, or from the log when replaying.
+class SIMULATION {
+public:
+	unsigned int tick = 0;
+	float alpha = 0.0f; // fraction of a tick the frame is past the last one
+	bool recording = false; // log live keys, saved to INPUT_LOG_FILE every SIM_HZ ticks
+	bool replaying = false; // keys come from log until its last tick
+	INPUT_LOG log; // being recorded or replayed
+
+	// new session: scene state reset from seed, recording starts over.
+	void start(unsigned long long seed);
+	// run the whole ticks in seconds (plus the carried remainder), returns how many ran.
+	int advance(double seconds, FrameBuffer* fb);
+	// play a recorded session's ticks back as fast as possible without
+	// rendering, print the time and whether the final state matches. the live
+	// session restarts afterwards.
+	void replay_headless(const char* fname);
+
+private:
+	double accumulator = 0.0; // real seconds not yet simulated
+	size_t next_key = 0; // log position while replaying
+	vector<int> keys; // applied this tick
+
+	// keys for this tick from log, advancing next_key.
+	void replay_keys(INPUT_LOG& from);
+	void step();
+};
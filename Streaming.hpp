@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Geometry.hpp"
+#include "ppc.h"
+
+using namespace std;
+
+#define STREAM_CLUSTER_TRIS 4096 // triangles per on-disk cluster
+#define STREAM_CACHE_MB 256 // resident cluster budget, never exceeded: the farthest visible clusters that don't fit are skipped
+#define STREAM_MIN_PIXELS 2.0f // clusters whose bounding sphere projects smaller are skipped
+#define STREAM_PREFETCH_FRAMES 10 // camera motion extrapolated this many frames for prefetch
+
+// table entry of a chunked mesh file. cluster data at offset: num_verts V3s,
+// then num_tris * 3 local U32 indices.
+class CLUSTER_INFO {
+public:
+	float lo[3], hi[3];
+	unsigned long long offset;
+	U32 num_verts, num_tris;
+};
+
+// replace the drawn set in meshes with next (next becomes drawn), false when
+// they are the same.
+bool swap_drawn(vector<MESH*>& meshes, vector<MESH*>& drawn, vector<MESH*>& next);
+
+// split mesh into spatially coherent clusters of STREAM_CLUSTER_TRIS
+// triangles and write them with their bounds. false on I/O failure.
+bool write_chunked_mesh(MESH& mesh, const char* fname);
+
+// a chunked mesh file, memory mapped. only clusters inside the frustum and
+// above the size cutoff are copied in, into a bounded LRU cache; a loader
+// thread prefetches the clusters the extrapolated camera will need.
+class STREAMED_MESH {
+public:
+	vector<CLUSTER_INFO> clusters;
+	U32 color = COLOR(255, 255, 255);
+	size_t budget; // resident bytes, a hard cap
+	size_t resident_bytes = 0;
+	// last update, skipped = visible but not drawn because they didn't fit the budget
+	int visible = 0, loads = 0, evictions = 0, prefetched = 0, skipped = 0;
+
+	STREAMED_MESH(const char* fname, size_t budget_bytes = (size_t)STREAM_CACHE_MB << 20);
+	~STREAMED_MESH();
+	bool is_open() { return data != 0; }
+	// resident_bytes, read under lock while the loader thread may be adding to it.
+	size_t resident_size();
+
+	// make the clusters visible from ppc resident (loading misses now, nearest
+	// first, evicting LRU clusters that aren't visible to make room, skipping
+	// the rest once the budget is full), put them in meshes in place of the
+	// last set and queue prefetches. returns whether the drawn set changed.
+	bool update(PPC* ppc, vector<MESH*>& meshes);
+
+private:
+	const unsigned char* data = 0;
+	size_t size = 0;
+	void* file_handle = 0; // platform mapping handles
+	void* map_handle = 0;
+
+	vector<MESH*> resident; // per cluster, 0 when not loaded
+	vector<U32> last_used; // frame stamp per cluster
+	vector<MESH*> drawn;
+	U32 frame = 0;
+	V3 last_C, last_a, last_b, last_c;
+
+	mutex lock; // resident / resident_bytes / queue
+	condition_variable wake;
+	deque<int> queue;
+	bool quit = false;
+	thread loader;
+
+	size_t cluster_bytes(int c) {
+		return clusters[c].num_verts * sizeof(V3) + clusters[c].num_tris * 3 * sizeof(U32);
+	}
+	MESH* load(int c);
+	// install a loaded cluster, false (and delete it) if it already was or
+	// doesn't fit the budget.
+	bool install(int c, MESH* mesh);
+	void visible_clusters(PPC* ppc, vector<int>& out);
+	void loader_main();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "Geometry.hpp"
+#include "ppc.h"
+
+using namespace std;
+
+#define TERRAIN_CHUNK 32 // quads per chunk side, at every level
+#define TERRAIN_LOD_DISTANCE 2.5f // a chunk closer than this many of its sizes is split
+#define TERRAIN_CACHE_CHUNKS 256 // generated chunk meshes kept around
+
+// quadtree LOD heightfield. level 0 chunks sample every height, each level up
+// covers twice the area with every other sample. chunk meshes are built on
+// first use (per stitching variant) and cached; only chunks in the frustum
+// are drawn.
+class TERRAIN {
+public:
+	int cols = 0, rows = 0; // samples
+	vector<float> heights; // world y per sample, row major
+	vector<V3> colors; // per sample when the source had them
+	V3 origin; // world position of sample (0, 0); columns go +x, rows -z
+	float step_x = 1.0f, step_z = 1.0f; // world distance between samples
+	int levels = 0; // the root chunk is level levels - 1
+	U32 color = COLOR(255, 255, 255);
+	// last update
+	int visible = 0, generated = 0;
+
+	// resample a grid mesh (vertices row major in x, then y, height in z,
+	// like terrain.bin) fitted to size around center.
+	TERRAIN(MESH& grid, V3 center, float size);
+	~TERRAIN();
+	bool is_valid() { return levels > 0; }
+
+	// pick chunk levels for ppc, put the visible chunk meshes in meshes in
+	// place of the last set. returns whether the drawn set changed.
+	bool update(PPC* ppc, vector<MESH*>& meshes);
+
+private:
+	class CHUNK_ENTRY {
+	public:
+		MESH* mesh;
+		U32 used;
+	};
+	vector<vector<float>> node_lo, node_hi; // height range per chunk, per level
+	vector<unsigned char> leaf_level; // per level 0 chunk, level of the chunk covering it
+	unordered_map<unsigned long long, CHUNK_ENTRY> cache;
+	vector<MESH*> drawn;
+	U32 frame = 0;
+
+	int chunks(int level) { return 1 << (levels - 1 - level); } // per side
+	float height(int i, int j);
+	void bounds(int level, int x, int z, float* lo, float* hi);
+	void select(PPC* ppc, int level, int x, int z, vector<int>& out);
+	// per edge (-x, +x, -z, +z) how many levels coarser the neighbour is.
+	U32 stitching(int level, int x, int z);
+	MESH* build_chunk(int level, int x, int z, U32 stitch);
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#define TETRIS_ROWS 20
+#define TETRIS_COLS 10
+#define TETRIS_FULL_ROW ((1 << TETRIS_COLS) - 1)
+#define TETRIS_SHAPES 3
+#define TETRIS_SPAWN_ROW 17 // row of a new piece's bottom line
+
+typedef unsigned short U16;
+
+// bitboard tetris. the board is one mask per row (bit c = column c, row 0 at
+// the bottom) and every piece rotation is precomputed as 3 row masks, so a
+// collision test is an AND per piece row and a line clear moves whole rows.
+class TETRIS {
+public:
+	U16 rows[TETRIS_ROWS + 3]; // + empty rows above the top for pieces sticking out
+	int shape = -1; // falling piece, -1 for none
+	int rotation = 0; // quarter turns clockwise
+	int row = TETRIS_SPAWN_ROW, col = 0; // board cell of the piece's 3x3 cell (0, 0)
+	int score = 0, high_score = 0; // lines cleared
+	unsigned int moves = 0; // piece moves tried (move / rotate / drop)
+
+	TETRIS();
+	// empty board, no piece; the high score stays.
+	void reset();
+	// new piece in the first column it fits at TETRIS_SPAWN_ROW. false (and
+	// the board resets, game over) when it fits nowhere.
+	bool spawn(int shape);
+	bool fits(int shape, int rotation, int row, int col);
+	// the falling piece dx columns sideways, when it fits.
+	bool move(int dx);
+	bool rotate();
+	// one row down, or lock the piece when blocked (full lines clear).
+	// returns whether it moved.
+	bool drop();
+	// rows with the falling piece drawn in.
+	void board(U16* out);
+
+private:
+	class PIECE {
+	public:
+		U16 mask[3]; // shape row i, bit j = shape column j
+		int left, right, bottom; // occupied column span + lowest occupied row
+	};
+	PIECE pieces[TETRIS_SHAPES][4];
+
+	U16 placed(U16 mask, int at) { return at >= 0 ? (U16)(mask << at) : (U16)(mask >> -at); }
+	void lock();
+	int clear_lines();
+};
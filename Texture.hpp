@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+typedef unsigned int U32;
+
+// square power of two texture, every mip level stored in Morton (Z) order
+// so the 2x2 footprint of a bilinear fetch is usually one cache line.
+class TEXTURE {
+public:
+	int size = 0; // level 0 side
+	int levels = 0;
+	vector<vector<U32>> mips;
+
+	TEXTURE();
+
+	bool LoadTiff(const char* fname);
+	// resample rgba (row major, w x h) to a power of two square and build mips.
+	void Build(U32* rgba, int w, int h);
+
+	inline U32 Texel(int level, int u, int v);
+	// u, v in texels of level 0 (repeat wrap), lod in mip levels.
+	U32 SampleBilinear(float u, float v, int level);
+	U32 SampleTrilinear(float u, float v, float lod);
+	U32 Sample(float u, float v, float lod);
+};
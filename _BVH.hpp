@@ -0,0 +1,419 @@
+#pragma once
+
+#include "BVH.hpp"
+#include "Geometry.hpp" // min3 / max3
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "Parallel.hpp"
+
+using namespace std;
+
+// pointer tree used while building, flattened afterwards.
+class BVH_BUILD_NODE {
+public:
+	float lo[3], hi[3];
+	BVH_BUILD_NODE* child[2] = { 0, 0 };
+	int first = 0, count = 0;
+	int axis = 0;
+};
+
+// shared, read only build input. refs is partitioned in place, every
+// subtree owns a disjoint [begin, end) of it so subtrees build concurrently.
+class BVH_BUILD {
+public:
+	const float* verts;
+	vector<float> centroids; // 3 per triangle
+	vector<float> bounds; // lo[3] hi[3] per triangle
+	vector<U32> refs;
+};
+
+static inline float boxArea(const float* lo, const float* hi) {
+	const float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline void growBox(float* lo, float* hi, const float* b) {
+	for (int d = 0; d < 3; d++) {
+		lo[d] = min(lo[d], b[d]);
+		hi[d] = max(hi[d], b[3 + d]);
+	}
+}
+
+// depth bounds the tree: past BVH_MAX_DEPTH - 32 levels every split halves
+// the count, so no path gets longer than the traversal stacks.
+static BVH_BUILD_NODE* bvhBuild(BVH_BUILD& ctx, int begin, int end, int depth) {
+	BVH_BUILD_NODE* node = new BVH_BUILD_NODE();
+	float clo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, chi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int d = 0; d < 3; d++) {
+		node->lo[d] = FLT_MAX;
+		node->hi[d] = -FLT_MAX;
+	}
+	for (int i = begin; i < end; i++) {
+		const U32 t = ctx.refs[i];
+		growBox(node->lo, node->hi, &ctx.bounds[t * 6]);
+		for (int d = 0; d < 3; d++) {
+			clo[d] = min(clo[d], ctx.centroids[t * 3 + d]);
+			chi[d] = max(chi[d], ctx.centroids[t * 3 + d]);
+		}
+	}
+	node->first = begin;
+	node->count = end - begin;
+	if (node->count <= BVH_LEAF_SIZE) return node;
+
+	// split along the widest centroid extent.
+	int axis = 0;
+	for (int d = 1; d < 3; d++) {
+		if (chi[d] - clo[d] > chi[axis] - clo[axis]) axis = d;
+	}
+	node->axis = axis;
+	const float extent = chi[axis] - clo[axis];
+	int mid = (begin + end) / 2;
+
+	if (depth >= BVH_MAX_DEPTH - 32) {
+		// too deep (clustered / degenerate input): median along the axis.
+		const float* c = ctx.centroids.data();
+		nth_element(&ctx.refs[begin], &ctx.refs[0] + mid, &ctx.refs[0] + end, [c, axis](U32 a, U32 b) {
+			return c[a * 3 + axis] < c[b * 3 + axis];
+		});
+	}
+	else if (extent > 0.0f) {
+		// SAH over BVH_BINS bins of centroids.
+		int bin_count[BVH_BINS] = {};
+		float bin_box[BVH_BINS][6];
+		for (int b = 0; b < BVH_BINS; b++) {
+			bin_box[b][0] = bin_box[b][1] = bin_box[b][2] = FLT_MAX;
+			bin_box[b][3] = bin_box[b][4] = bin_box[b][5] = -FLT_MAX;
+		}
+		const float scale = BVH_BINS * (1.0f - 1e-5f) / extent;
+		for (int i = begin; i < end; i++) {
+			const U32 t = ctx.refs[i];
+			const int b = (int)((ctx.centroids[t * 3 + axis] - clo[axis]) * scale);
+			bin_count[b]++;
+			growBox(bin_box[b], bin_box[b] + 3, &ctx.bounds[t * 6]);
+		}
+		// sweep from the right, then from the left.
+		float right_area[BVH_BINS];
+		int right_count[BVH_BINS];
+		float box[6] = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		int count = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--) {
+			growBox(box, box + 3, bin_box[b]);
+			count += bin_count[b];
+			right_area[b] = count ? boxArea(box, box + 3) : 0.0f;
+			right_count[b] = count;
+		}
+		float best_cost = FLT_MAX;
+		int best = -1;
+		box[0] = box[1] = box[2] = FLT_MAX;
+		box[3] = box[4] = box[5] = -FLT_MAX;
+		count = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++) {
+			growBox(box, box + 3, bin_box[b]);
+			count += bin_count[b];
+			if (!count || !right_count[b + 1]) continue;
+			const float cost = count * boxArea(box, box + 3) + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best = b;
+			}
+		}
+		// leaf if splitting does not pay (traversal step ~ one triangle test).
+		const float leaf_cost = node->count * boxArea(node->lo, node->hi);
+		if (best < 0 || (node->count <= 4 * BVH_LEAF_SIZE && best_cost + boxArea(node->lo, node->hi) >= leaf_cost)) {
+			if (node->count <= 4 * BVH_LEAF_SIZE) return node;
+		}
+		if (best >= 0) {
+			const float* c = ctx.centroids.data();
+			const float base = clo[axis];
+			U32* split = partition(&ctx.refs[begin], &ctx.refs[0] + end, [c, axis, base, scale, best](U32 t) {
+				return (int)((c[t * 3 + axis] - base) * scale) <= best;
+			});
+			mid = (int)(split - &ctx.refs[0]);
+		}
+	}
+	// degenerate (all centroids equal): split by count to keep leaves small.
+	if (mid == begin || mid == end) mid = (begin + end) / 2;
+
+	if (node->count >= BVH_PARALLEL_MIN) {
+		parallel_invoke(
+			[&ctx, node, begin, mid, depth] { node->child[0] = bvhBuild(ctx, begin, mid, depth + 1); },
+			[&ctx, node, mid, end, depth] { node->child[1] = bvhBuild(ctx, mid, end, depth + 1); });
+	}
+	else {
+		node->child[0] = bvhBuild(ctx, begin, mid, depth + 1);
+		node->child[1] = bvhBuild(ctx, mid, end, depth + 1);
+	}
+	return node;
+}
+
+// depth first, first child right after its parent. frees the build tree.
+static int bvhFlatten(vector<BVH_NODE>& nodes, BVH_BUILD_NODE* b) {
+	const int index = (int)nodes.size();
+	nodes.push_back(BVH_NODE());
+	for (int d = 0; d < 3; d++) {
+		nodes[index].lo[d] = b->lo[d];
+		nodes[index].hi[d] = b->hi[d];
+	}
+	nodes[index].axis = (unsigned short)b->axis;
+	if (!b->child[0]) {
+		nodes[index].offset = b->first;
+		nodes[index].count = (unsigned short)b->count;
+	}
+	else {
+		bvhFlatten(nodes, b->child[0]);
+		const int second = bvhFlatten(nodes, b->child[1]);
+		nodes[index].offset = second;
+		nodes[index].count = 0;
+	}
+	delete b;
+	return index;
+}
+
+void BVH::build(const vector<float>& tri_verts, const vector<U32>& tri_ids) {
+	auto t1 = chrono::high_resolution_clock::now();
+	builds++;
+	nodes.clear();
+	verts.clear();
+	ids.clear();
+	const int n = (int)tri_ids.size();
+	if (n == 0) return;
+
+	BVH_BUILD ctx;
+	ctx.verts = tri_verts.data();
+	ctx.centroids.resize(n * 3);
+	ctx.bounds.resize(n * 6);
+	ctx.refs.resize(n);
+	parallel_for(0, n, [&ctx](int lo, int hi) {
+		for (int t = lo; t < hi; t++) {
+			const float* v = ctx.verts + t * 9;
+			for (int d = 0; d < 3; d++) {
+				const float a = min3(v[d], v[3 + d], v[6 + d]);
+				const float b = max3(v[d], v[3 + d], v[6 + d]);
+				ctx.bounds[t * 6 + d] = a;
+				ctx.bounds[t * 6 + 3 + d] = b;
+				ctx.centroids[t * 3 + d] = (a + b) * 0.5f;
+			}
+			ctx.refs[t] = t;
+		}
+	});
+
+	BVH_BUILD_NODE* root = bvhBuild(ctx, 0, n, 0);
+	nodes.reserve(2 * n / BVH_LEAF_SIZE + 1);
+	bvhFlatten(nodes, root);
+
+	// triangles in leaf order, so a leaf reads one contiguous block.
+	verts.resize(n * 9);
+	ids.resize(n);
+	for (int i = 0; i < n; i++) {
+		const U32 t = ctx.refs[i];
+		copy(ctx.verts + t * 9, ctx.verts + t * 9 + 9, &verts[i * 9]);
+		ids[i] = tri_ids[t];
+	}
+	auto t2 = chrono::high_resolution_clock::now();
+	build_ms = chrono::duration<double, milli>(t2 - t1).count();
+}
+
+// slab test, entry distance in t_near.
+static inline bool hitBox(const BVH_NODE& node, const float* o, const float* inv, float t_max, float& t_near) {
+	float t0 = 0.0f, t1 = t_max;
+	for (int d = 0; d < 3; d++) {
+		float a = (node.lo[d] - o[d]) * inv[d];
+		float b = (node.hi[d] - o[d]) * inv[d];
+		if (a > b) swap(a, b);
+		t0 = max(t0, a);
+		t1 = min(t1, b);
+	}
+	t_near = t0;
+	return t0 <= t1;
+}
+
+// Moller-Trumbore, updates t_max on a closer hit.
+static inline bool hitTriangle(const float* v, const float* o, const float* dir, float& t_max) {
+	const float e1[3] = { v[3] - v[0], v[4] - v[1], v[5] - v[2] };
+	const float e2[3] = { v[6] - v[0], v[7] - v[1], v[8] - v[2] };
+	const float p[3] = {
+		dir[1] * e2[2] - dir[2] * e2[1],
+		dir[2] * e2[0] - dir[0] * e2[2],
+		dir[0] * e2[1] - dir[1] * e2[0]
+	};
+	const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+	if (fabs(det) < 1e-12f) return false;
+	const float inv_det = 1.0f / det;
+	const float s[3] = { o[0] - v[0], o[1] - v[1], o[2] - v[2] };
+	const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+	if (u < 0.0f || u > 1.0f) return false;
+	const float q[3] = {
+		s[1] * e1[2] - s[2] * e1[1],
+		s[2] * e1[0] - s[0] * e1[2],
+		s[0] * e1[1] - s[1] * e1[0]
+	};
+	const float v_ = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) * inv_det;
+	if (v_ < 0.0f || u + v_ > 1.0f) return false;
+	const float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+	if (t <= 0.0f || t >= t_max) return false;
+	t_max = t;
+	return true;
+}
+
+U32 BVH::intersect(const float* origin, const float* dir, float& t_max) {
+	if (nodes.empty()) return 0xFFFFFFFF;
+	const float inv[3] = { 1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2] };
+	U32 hit = 0xFFFFFFFF;
+	int stack[BVH_MAX_DEPTH]; // one entry per level at most
+	int top = 0;
+	int n = 0;
+	while (true) {
+		const BVH_NODE& node = nodes[n];
+		float t_near;
+		if (hitBox(node, origin, inv, t_max, t_near)) {
+			if (node.count) {
+				for (U32 i = node.offset; i < node.offset + node.count; i++) {
+					if (hitTriangle(&verts[i * 9], origin, dir, t_max)) hit = ids[i];
+				}
+			}
+			else {
+				// near child first along the split axis.
+				if (dir[node.axis] < 0.0f) {
+					stack[top++] = n + 1;
+					n = node.offset;
+				}
+				else {
+					stack[top++] = node.offset;
+					n = n + 1;
+				}
+				continue;
+			}
+		}
+		if (top == 0) break;
+		n = stack[--top];
+	}
+	return hit;
+}
+
+// select a where mask is set, else b.
+static inline __m128 blend4(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+void BVH::intersect4(const float* origin, const float* dirs, float* t_max, U32* hit) {
+	if (nodes.empty()) return;
+	const __m128 ox = _mm_set1_ps(origin[0]), oy = _mm_set1_ps(origin[1]), oz = _mm_set1_ps(origin[2]);
+	const __m128 dx = _mm_loadu_ps(dirs), dy = _mm_loadu_ps(dirs + 4), dz = _mm_loadu_ps(dirs + 8);
+	const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+	const __m128 ix = _mm_div_ps(one, dx), iy = _mm_div_ps(one, dy), iz = _mm_div_ps(one, dz);
+	__m128 tmax = _mm_loadu_ps(t_max);
+	__m128 hits = _mm_loadu_ps((const float*)hit);
+	// packets are coherent, the first ray decides the child order.
+	const bool dir_neg[3] = { dirs[0] < 0.0f, dirs[4] < 0.0f, dirs[8] < 0.0f };
+
+	int stack[BVH_MAX_DEPTH]; // one entry per level at most
+	int top = 0;
+	int n = 0;
+	while (true) {
+		const BVH_NODE& node = nodes[n];
+		// slab test, all 4 rays at once.
+		__m128 a = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lo[0]), ox), ix);
+		__m128 b = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.hi[0]), ox), ix);
+		__m128 t0 = _mm_max_ps(zero, _mm_min_ps(a, b));
+		__m128 t1 = _mm_min_ps(tmax, _mm_max_ps(a, b));
+		a = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lo[1]), oy), iy);
+		b = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.hi[1]), oy), iy);
+		t0 = _mm_max_ps(t0, _mm_min_ps(a, b));
+		t1 = _mm_min_ps(t1, _mm_max_ps(a, b));
+		a = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lo[2]), oz), iz);
+		b = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.hi[2]), oz), iz);
+		t0 = _mm_max_ps(t0, _mm_min_ps(a, b));
+		t1 = _mm_min_ps(t1, _mm_max_ps(a, b));
+
+		if (_mm_movemask_ps(_mm_cmple_ps(t0, t1))) {
+			if (node.count) {
+				for (U32 i = node.offset; i < node.offset + node.count; i++) {
+					// Moller-Trumbore, s = o - v0 and q = s x e1 are shared by the packet.
+					const float* v = &verts[i * 9];
+					const float e1[3] = { v[3] - v[0], v[4] - v[1], v[5] - v[2] };
+					const float e2[3] = { v[6] - v[0], v[7] - v[1], v[8] - v[2] };
+					const float s[3] = { origin[0] - v[0], origin[1] - v[1], origin[2] - v[2] };
+					const float q[3] = {
+						s[1] * e1[2] - s[2] * e1[1],
+						s[2] * e1[0] - s[0] * e1[2],
+						s[0] * e1[1] - s[1] * e1[0]
+					};
+					const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, _mm_set1_ps(e2[2])), _mm_mul_ps(dz, _mm_set1_ps(e2[1])));
+					const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, _mm_set1_ps(e2[0])), _mm_mul_ps(dx, _mm_set1_ps(e2[2])));
+					const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, _mm_set1_ps(e2[1])), _mm_mul_ps(dy, _mm_set1_ps(e2[0])));
+					const __m128 det = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(e1[0])),
+						_mm_add_ps(_mm_mul_ps(py, _mm_set1_ps(e1[1])), _mm_mul_ps(pz, _mm_set1_ps(e1[2]))));
+					const __m128 inv_det = _mm_div_ps(one, det);
+					const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(s[0])),
+						_mm_add_ps(_mm_mul_ps(py, _mm_set1_ps(s[1])), _mm_mul_ps(pz, _mm_set1_ps(s[2])))), inv_det);
+					const __m128 w = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(q[0])),
+						_mm_add_ps(_mm_mul_ps(dy, _mm_set1_ps(q[1])), _mm_mul_ps(dz, _mm_set1_ps(q[2])))), inv_det);
+					const __m128 t = _mm_mul_ps(_mm_set1_ps(e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]), inv_det);
+					// |det| > eps, u >= 0, w >= 0, u + w <= 1, 0 < t < t_max
+					const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+					__m128 mask = _mm_cmpgt_ps(abs_det, _mm_set1_ps(1e-12f));
+					mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+					mask = _mm_and_ps(mask, _mm_cmpge_ps(w, zero));
+					mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, w), one));
+					mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+					mask = _mm_and_ps(mask, _mm_cmplt_ps(t, tmax));
+					if (!_mm_movemask_ps(mask)) continue;
+					tmax = blend4(mask, t, tmax);
+					hits = blend4(mask, _mm_castsi128_ps(_mm_set1_epi32((int)ids[i])), hits);
+				}
+			}
+			else {
+				if (dir_neg[node.axis]) {
+					stack[top++] = n + 1;
+					n = node.offset;
+				}
+				else {
+					stack[top++] = node.offset;
+					n = n + 1;
+				}
+				continue;
+			}
+		}
+		if (top == 0) break;
+		n = stack[--top];
+	}
+	_mm_storeu_ps(t_max, tmax);
+	_mm_storeu_ps((float*)hit, hits);
+}
+
+void BVH::cull(const float* planes, int num_planes, vector<U32>& out) {
+	out.clear();
+	if (!nodes.empty()) cull_node(0, planes, num_planes, false, out);
+}
+
+// inside = every plane already passed by an ancestor, no more box tests.
+void BVH::cull_node(int n, const float* planes, int num_planes, bool inside, vector<U32>& out) {
+	const BVH_NODE& node = nodes[n];
+	if (!inside) {
+		inside = true;
+		for (int p = 0; p < num_planes; p++) {
+			const float* pl = planes + p * 4;
+			// box corners furthest along / against the plane normal
+			float far_d = pl[3], near_d = pl[3];
+			for (int d = 0; d < 3; d++) {
+				far_d += pl[d] * (pl[d] >= 0.0f ? node.hi[d] : node.lo[d]);
+				near_d += pl[d] * (pl[d] >= 0.0f ? node.lo[d] : node.hi[d]);
+			}
+			if (far_d < 0.0f) return;
+			if (near_d < 0.0f) inside = false;
+		}
+	}
+	if (node.count) {
+		for (U32 i = node.offset; i < node.offset + node.count; i++) out.push_back(ids[i]);
+		return;
+	}
+	cull_node(n + 1, planes, num_planes, inside, out);
+	cull_node(node.offset, planes, num_planes, inside, out);
+}
@@ -4,10 +4,27 @@
 
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
 #include "Dimension.hpp"
 #include "M33.hpp"
 #include "scene.h"
+#include "_Parallel.hpp"
+#include "_RadixSort.hpp"
+#include "_SceneGraph.hpp"
+#include "_BVH.hpp"
+#include "_Simplify.hpp"
+#include "_MeshOptimize.hpp"
+#include "_QuantizedMesh.hpp"
+#include "_Streaming.hpp"
+#include "_Terrain.hpp"
+#include "_Simulation.hpp"
+#include "_Tetris.hpp"
 
 inline U32 GEO_META::scaleColor(float scalar) {
 	U32 r = (color & 255) * scalar;
@@ -86,12 +103,97 @@ TRIANGLE::TRIANGLE(V3(&points)[3], U32 color, U32 width) {
 }
 
 
+MESH::MESH() {}
+
+MESH::MESH(const char* fname) {
+	LoadBin(fname);
+}
+
+MESH::~MESH() {
+	delete[] verts;
+	delete[] colors;
+	delete[] normals;
+	delete[] tcs;
+	delete[] tris;
+	delete packed;
+	if (!base) delete texture;
+	for (MESH* lod : lods) delete lod;
+}
+
+// int vert count, 4 y/n flags (xyz, rgb, normals, uv), vertex arrays, int tri count, indices.
+void MESH::LoadBin(const char* fname) {
+	ifstream in(fname, ios::binary);
+	if (!in) {
+		cout << fname << " could not be opened" << endl;
+		return;
+	}
+
+	in.read((char*)&num_verts, sizeof(int));
+	char flags[4];
+	in.read(flags, 4);
+	if (flags[0] != 'y') {
+		cout << fname << " has no vertex positions" << endl;
+		num_verts = 0;
+		return;
+	}
+
+	verts = new V3[num_verts];
+	in.read((char*)verts, num_verts * 3 * sizeof(float));
+	if (flags[1] == 'y') {
+		colors = new V3[num_verts];
+		in.read((char*)colors, num_verts * 3 * sizeof(float));
+	}
+	if (flags[2] == 'y') {
+		normals = new V3[num_verts];
+		in.read((char*)normals, num_verts * 3 * sizeof(float));
+	}
+	if (flags[3] == 'y') {
+		tcs = new float[num_verts * 2];
+		in.read((char*)tcs, num_verts * 2 * sizeof(float));
+	}
+
+	in.read((char*)&num_tris, sizeof(int));
+	tris = new U32[num_tris * 3];
+	in.read((char*)tris, num_tris * 3 * sizeof(U32));
+	if (!in) {
+		cout << "failed to load " << fname << endl;
+		num_tris = 0;
+		return;
+	}
+	cout << fname << ": " << num_verts << " vertices, " << num_tris << " triangles\n";
+}
+
+void MESH::Fit(V3 center, float size) {
+	if (!num_verts || packed) return;
+	V3 lo = verts[0], hi = verts[0];
+	for (int i = 1; i < num_verts; i++) {
+		for (int d = 0; d < 3; d++) {
+			lo[d] = min(lo[d], verts[i][d]);
+			hi[d] = max(hi[d], verts[i][d]);
+		}
+	}
+	const float extent = max3(hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]);
+	const float scale = extent > 0 ? size / extent : 1.0f;
+	for (int i = 0; i < num_verts; i++) {
+		for (int d = 0; d < 3; d++) {
+			verts[i][d] = (verts[i][d] - (lo[d] + hi[d]) * 0.5f) * scale + center[d];
+		}
+	}
+}
+
+INSTANCE::INSTANCE() {}
+
+INSTANCE::INSTANCE(MESH* mesh, M33 rotation, V3 translation, U32 tint) {
+	this->mesh = mesh;
+	this->rotation = rotation;
+	this->translation = translation;
+	this->tint = tint;
+}
+
 GEOMETRY::GEOMETRY() {}
 
 void GEOMETRY::setup_pong() {
-	num_spheres = 0;
-	num_segments = 0;
-	num_triangles = 0;
+	clear();
 
 	{ // playing feild
 		V3 corners[] = {
@@ -113,65 +215,44 @@ void GEOMETRY::setup_pong() {
 			add_segment(seg);
 		}
 	}
-	{ // player 1
-		V3 corners[] = {
-			V3(50, -200, 0) + scene->player1,
-			V3(50, -190, 0) + scene->player1,
-			V3(0, -190, 0) + scene->player1,
-			V3(0, -200, 0) + scene->player1
-		};
-		SEGMENT segs[] = {
-			SEGMENT(corners[0], corners[1], COLOR(255, 255, 255)),
-			SEGMENT(corners[1], corners[2], COLOR(255, 255, 255)),
-			SEGMENT(corners[2], corners[3], COLOR(255, 255, 255)),
-			SEGMENT(corners[3], corners[0], COLOR(255, 255, 255))
-		};
-		for (SEGMENT& seg : segs) {
-			add_segment(seg);
-		}
+	// players + ball in their own nodes, moved by update_pong.
+	for (int i = 0; i < 3; i++) {
+		if (!pong_nodes[i]) pong_nodes[i] = scene->root->add_child();
 	}
-	{ // player 2
+	for (int p = 0; p < 2; p++) {
+		const float y0 = p ? 200.0f : -200.0f;
+		const float y1 = p ? 190.0f : -190.0f;
 		V3 corners[] = {
-			V3(50, 200, 0) + scene->player2,
-			V3(50, 190, 0) + scene->player2,
-			V3(0, 190, 0) + scene->player2,
-			V3(0, 200, 0) + scene->player2
+			V3(50, y0, 0),
+			V3(50, y1, 0),
+			V3(0, y1, 0),
+			V3(0, y0, 0)
 		};
-		SEGMENT segs[] = {
-			SEGMENT(corners[0], corners[1], COLOR(255, 255, 255)),
-			SEGMENT(corners[1], corners[2], COLOR(255, 255, 255)),
-			SEGMENT(corners[2], corners[3], COLOR(255, 255, 255)),
-			SEGMENT(corners[3], corners[0], COLOR(255, 255, 255))
-		};
-		for (SEGMENT& seg : segs) {
-			add_segment(seg);
+		for (int k = 0; k < 4; k++) {
+			pong_paddles[p][k] = add_segment(SEGMENT(corners[k], corners[(k + 1) % 4], COLOR(255, 255, 255)));
+			attach(pong_paddles[p][k], pong_nodes[p]);
 		}
 	}
-	{ // ball
-		V3 ball_pos = V3(0, 0, 0) + scene->ball_pos;
-		add_sphere(SPHERE(ball_pos, COLOR(0, 0, 255), 10));
+	V3 ball_center = V3(0, 0, 0);
+	pong_ball = add_sphere(SPHERE(ball_center, COLOR(0, 0, 255), 10));
+	attach(pong_ball, pong_nodes[2]);
+	update_pong();
+}
+
+// one node translation per moving object, nothing is rebuilt. alpha
+// interpolates from the previous simulation tick to the last one.
+void GEOMETRY::update_pong(float alpha) {
+	V3* from[3] = { &scene->prev_player1, &scene->prev_player2, &scene->prev_ball_pos };
+	V3* to[3] = { &scene->player1, &scene->player2, &scene->ball_pos };
+	for (int k = 0; k < 3; k++) {
+		V3 at;
+		for (int d = 0; d < 3; d++) at[d] = (*from[k])[d] + ((*to[k])[d] - (*from[k])[d]) * alpha;
+		pong_nodes[k]->set_translation(at);
 	}
 }
 
 void GEOMETRY::setup_tetris() {
-	num_spheres = 0;
-	num_segments = 0;
-	num_triangles = 0;
-
-	bool grid[20][10];
-	for (int r = 0; r < 20; r++) {
-		for (int c = 0; c < 10; c++) {
-			grid[r][c] = scene->grid[r][c];
-		}
-	}
-	for (int i = 0; i < 3; i++) {
-		for (int j = 0; j < 3; j++) {
-			int r = scene->pos.first + i;
-			int c = scene->pos.second + j;
-			if (r >= 0 && r < 20 && c >= 0 && c < 10)
-				grid[r][c] = scene->shapes[scene->curr_shape][i][j];
-		}
-	}
+	clear();
 
 	// border
 	V3 c1 = V3(0.0f, 0.0f, 0.0f);
@@ -183,9 +264,30 @@ void GEOMETRY::setup_tetris() {
 	add_segment(SEGMENT(c3, c4));
 	add_segment(SEGMENT(c4, c1));
 
+	for (int r = 0; r < 20; r++) {
+		for (int c = 0; c < 10; c++) {
+			tetris_shown[r][c] = false;
+		}
+	}
+	update_tetris();
+}
+
+// cells are added / removed only when they change state.
+void GEOMETRY::update_tetris() {
+	U16 rows[TETRIS_ROWS];
+	scene->tetris.board(rows);
+	bool grid[20][10];
+	for (int r = 0; r < 20; r++) {
+		for (int c = 0; c < 10; c++) {
+			grid[r][c] = (rows[r] >> c) & 1;
+		}
+	}
+
 	// draw board
 	for (int r = 0; r < 20; r++) {
 		for (int c = 0; c < 10; c++) {
+			if (grid[r][c] == tetris_shown[r][c]) continue;
+			tetris_shown[r][c] = grid[r][c];
 			if (grid[r][c]) {
 				V3 p1 = V3(c * 20 + 2, r * 20 + 2, 0);
 				V3 p2 = V3(c * 20 + 2, r * 20 + 18, 0);
@@ -193,8 +295,12 @@ void GEOMETRY::setup_tetris() {
 				V3 p4 = V3(c * 20 + 18, r * 20 + 2, 0);
 				V3 t1[3] = { p1, p2, p3 };
 				V3 t2[3] = { p3, p4, p1 };
-				add_triangle(TRIANGLE(t1));
-				add_triangle(TRIANGLE(t2));
+				tetris_cells[r][c][0] = add_triangle(TRIANGLE(t1));
+				tetris_cells[r][c][1] = add_triangle(TRIANGLE(t2));
+			}
+			else {
+				remove(tetris_cells[r][c][0]);
+				remove(tetris_cells[r][c][1]);
 			}
 		}
 	}
@@ -226,79 +332,750 @@ void GEOMETRY::add_axis() {
 	add_segment(SEGMENT(V3(0, 0, -200), V3(0, 0, 200)));
 }
 
-inline void GEOMETRY::add_segment(SEGMENT seg) {
-	segments[num_segments++] = seg;
+// reuse a removed slot of this type, else grow count.
+U32 GEOMETRY::new_slot(int type, int& count) {
+	U32 i;
+	if (!free_slots[type].empty()) {
+		i = free_slots[type].back();
+		free_slots[type].pop_back();
+	}
+	else {
+		i = count++;
+	}
+	flags[type][i] = GEO_ALIVE | GEO_DIRTY;
+	slot_node[type][i] = 0;
+	return i;
 }
 
-inline void GEOMETRY::add_sphere(SPHERE sph) {
-	spheres[num_spheres++] = sph;
+inline U32 GEOMETRY::add_segment(SEGMENT seg) {
+	const U32 i = new_slot(VIS_SEGMENT, num_segments);
+	segments[i] = seg;
+	return VIS_ID(VIS_SEGMENT, i);
 }
 
-inline void GEOMETRY::add_triangle(TRIANGLE tri) {
-	triangles[num_triangles++] = tri;
+inline U32 GEOMETRY::add_sphere(SPHERE sph) {
+	const U32 i = new_slot(VIS_SPHERE, num_spheres);
+	spheres[i] = sph;
+	return VIS_ID(VIS_SPHERE, i);
 }
 
-COMPUTED_GEOMETRY::COMPUTED_GEOMETRY() {
-	recompute_geometry();
+inline U32 GEOMETRY::add_triangle(TRIANGLE tri) {
+	const U32 i = new_slot(VIS_TRIANGLE, num_triangles);
+	triangles[i] = tri;
+	return VIS_ID(VIS_TRIANGLE, i);
 }
 
-// rotate + copy geometry
-void COMPUTED_GEOMETRY::recompute_geometry() {
+void GEOMETRY::add_mesh(MESH* mesh) {
+	meshes.push_back(mesh);
+	dirty_all = true;
+	meshes_changed = true;
+}
+
+int GEOMETRY::add_instance(INSTANCE inst) {
+	if (inst.node) inst.node->instances.push_back((int)instances.size());
+	instances.push_back(inst);
+	dirty_all = true;
+	meshes_changed = true;
+	return (int)instances.size() - 1;
+}
+
+void GEOMETRY::place_instance(int i, M33 rotation, V3 translation) {
+	instances[i].rotation = rotation;
+	instances[i].translation = translation;
+	instances[i].dirty = true;
+}
+
+inline bool GEOMETRY::alive(U32 handle) {
+	return (flags[VIS_TYPE(handle)][VIS_INDEX(handle)] & GEO_ALIVE) != 0;
+}
+
+inline void GEOMETRY::mark_dirty(U32 handle) {
+	flags[VIS_TYPE(handle)][VIS_INDEX(handle)] |= GEO_DIRTY;
+}
+
+void GEOMETRY::move(U32 handle, V3 delta) {
+	const U32 i = VIS_INDEX(handle);
+	switch (VIS_TYPE(handle)) {
+		case VIS_SEGMENT: segments[i].start += delta; segments[i].end += delta; break;
+		case VIS_SPHERE: spheres[i].point += delta; break;
+		case VIS_TRIANGLE: for (V3& p : triangles[i].points) p += delta; break;
+		default: return;
+	}
+	mark_dirty(handle);
+}
+
+void GEOMETRY::recolor(U32 handle, U32 color) {
+	const U32 i = VIS_INDEX(handle);
+	switch (VIS_TYPE(handle)) {
+		case VIS_SEGMENT: segments[i].color = color; break;
+		case VIS_SPHERE: spheres[i].color = color; break;
+		case VIS_TRIANGLE: triangles[i].color = color; break;
+		default: return;
+	}
+	mark_dirty(handle);
+}
+
+void GEOMETRY::attach(U32 handle, NODE* node) {
+	NODE*& old = slot_node[VIS_TYPE(handle)][VIS_INDEX(handle)];
+	if (old) old->handles.erase(remove_if(old->handles.begin(), old->handles.end(), [handle](U32 h) { return h == handle; }), old->handles.end());
+	old = node;
+	if (node) node->handles.push_back(handle);
+	mark_dirty(handle);
+}
+
+void GEOMETRY::attach_instance(int i, NODE* node) {
+	NODE*& old = instances[i].node;
+	if (old) old->instances.erase(remove_if(old->instances.begin(), old->instances.end(), [i](int k) { return k == i; }), old->instances.end());
+	old = node;
+	if (node) node->instances.push_back(i);
+	instances[i].dirty = true;
+}
+
+// the slot stays dirty (dead) until COMPUTED_GEOMETRY drops it.
+void GEOMETRY::remove(U32 handle) {
+	const int type = VIS_TYPE(handle);
+	if (type == VIS_MESH || !alive(handle)) return;
+	attach(handle, 0);
+	flags[type][VIS_INDEX(handle)] = GEO_DIRTY;
+	free_slots[type].push_back(VIS_INDEX(handle));
+}
+
+void GEOMETRY::set_segment(U32 handle, SEGMENT seg) {
+	SEGMENT& old = segments[VIS_INDEX(handle)];
+	if (memcmp(&old, &seg, sizeof(seg)) == 0) return;
+	old = seg;
+	mark_dirty(handle);
+}
+
+void GEOMETRY::set_sphere(U32 handle, SPHERE sph) {
+	SPHERE& old = spheres[VIS_INDEX(handle)];
+	if (memcmp(&old, &sph, sizeof(sph)) == 0) return;
+	old = sph;
+	mark_dirty(handle);
+}
+
+void GEOMETRY::set_triangle(U32 handle, TRIANGLE tri) {
+	TRIANGLE& old = triangles[VIS_INDEX(handle)];
+	if (memcmp(&old, &tri, sizeof(tri)) == 0) return;
+	old = tri;
+	mark_dirty(handle);
+}
+
+void GEOMETRY::clear() {
+	const int counts[3] = { num_segments, num_spheres, num_triangles };
+	for (int type = 0; type < 3; type++) {
+		for (int i = 0; i < counts[type]; i++) {
+			if (slot_node[type][i]) attach(VIS_ID(type, i), 0);
+		}
+	}
 	num_segments = 0;
 	num_spheres = 0;
 	num_triangles = 0;
+	for (int type = 0; type < 3; type++) {
+		fill(flags[type], flags[type] + GEO_MAX_PRIMITIVES, 0);
+		free_slots[type].clear();
+	}
+	dirty_all = true;
+}
+
+// per channel product of two colors.
+static inline U32 tintColor(U32 color, U32 tint) {
+	const U32 r = (color & 255) * (tint & 255) / 255;
+	const U32 g = ((color >> 8) & 255) * ((tint >> 8) & 255) / 255;
+	const U32 b = ((color >> 16) & 255) * ((tint >> 16) & 255) / 255;
+	return COLOR(r, g, b);
+}
+
+// instance rotation / translation composed with its node's world transform.
+static inline void instanceToWorld(INSTANCE& inst, M33& r, V3& t) {
+	M33& nr = inst.node->world_rotation;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			r[i][j] = nr[i][0] * inst.rotation[0][j] + nr[i][1] * inst.rotation[1][j] + nr[i][2] * inst.rotation[2][j];
+		}
+	}
+	t = inst.node->to_world(inst.translation);
+}
+
+COMPUTED_GEOMETRY::COMPUTED_GEOMETRY() {
+	segment_points.resize(2 * GEO_MAX_PRIMITIVES);
+	sphere_points.resize(GEO_MAX_PRIMITIVES);
+	triangle_points.resize(3 * GEO_MAX_PRIMITIVES);
+	recompute_geometry();
+}
+
+// the projection only changes with the camera.
+bool COMPUTED_GEOMETRY::camera_moved() {
+	PPC* ppc = scene->ppc;
+	V3 now[4] = { ppc->a, ppc->b, ppc->c, ppc->C };
+	if (memcmp(camera, now, sizeof(now)) == 0) return false;
+	memcpy(camera, now, sizeof(now));
+	return true;
+}
+
+// rotate + copy geometry. retained: only slots flagged dirty since the last
+// call are projected again, static scenery costs nothing per frame.
+void COMPUTED_GEOMETRY::recompute_geometry() {
+	GEOMETRY& geometry = scene->geometry;
+	// node transforms first, moved nodes mark what they carry dirty.
+	scene->root->update();
+	// streamed clusters swap in and out of meshes with the view.
+	for (STREAMED_MESH* stream : geometry.streams) {
+		if (stream->update(scene->ppc, geometry.meshes)) geometry.dirty_all = geometry.meshes_changed = true;
+	}
+	if (geometry.terrain && geometry.terrain->update(scene->ppc, geometry.meshes)) geometry.dirty_all = geometry.meshes_changed = true;
+	const bool all = camera_moved() || geometry.dirty_all;
+	geometry.dirty_all = false;
+	reprojected = 0;
+	num_segments = geometry.num_segments;
+	num_spheres = geometry.num_spheres;
+	num_triangles = geometry.num_triangles;
+
+	// each slot type is one data parallel pass. a job gathers the world
+	// points of its dirty slots into PROJECT_BATCH sized x / y / z arrays,
+	// projects them 4 at a time and scatters them to the slots' entries.
+	auto project_slots = [&](int type, int count, int k, bool* alive, PROJECTED_POINTS& out, function<void(int, V3*)> world_points) {
+		return parallel_reduce(0, count, 0, [&](int lo, int hi) {
+			float wx[PROJECT_BATCH], wy[PROJECT_BATCH], wz[PROJECT_BATCH];
+			float px[PROJECT_BATCH], py[PROJECT_BATCH], pz[PROJECT_BATCH];
+			int slots[PROJECT_BATCH];
+			int dirty = 0;
+			for (int i = lo; i < hi;) {
+				int n = 0;
+				for (; i < hi && (n + 1) * k <= PROJECT_BATCH; i++) {
+					unsigned char& flags = geometry.flags[type][i];
+					if (!all && !(flags & GEO_DIRTY)) continue;
+					flags &= ~GEO_DIRTY;
+					dirty++;
+					alive[i] = (flags & GEO_ALIVE) != 0;
+					if (!alive[i]) continue;
+					V3 world[3];
+					world_points(i, world);
+					for (int j = 0; j < k; j++) {
+						wx[n * k + j] = world[j][Dim::X];
+						wy[n * k + j] = world[j][Dim::Y];
+						wz[n * k + j] = world[j][Dim::Z];
+					}
+					slots[n++] = i;
+				}
+				project_points(wx, wy, wz, n * k, px, py, pz);
+				for (int s = 0; s < n; s++) {
+					for (int j = 0; j < k; j++) {
+						out.x[slots[s] * k + j] = px[s * k + j];
+						out.y[slots[s] * k + j] = py[s * k + j];
+						out.z[slots[s] * k + j] = pz[s * k + j];
+					}
+				}
+			}
+			return dirty;
+		}, [](int a, int b) { return a + b; });
+	};
+
+	reprojected += project_slots(VIS_SEGMENT, geometry.num_segments, 2, segment_alive, segment_points, [&](int i, V3* world) {
+		SEGMENT& seg = geometry.segments[i];
+		NODE* node = geometry.slot_node[VIS_SEGMENT][i];
+		world[0] = node ? node->to_world(seg.start) : seg.start;
+		world[1] = node ? node->to_world(seg.end) : seg.end;
+	});
+	reprojected += project_slots(VIS_TRIANGLE, geometry.num_triangles, 3, triangle_alive, triangle_points, [&](int i, V3* world) {
+		TRIANGLE& tri = geometry.triangles[i];
+		NODE* node = geometry.slot_node[VIS_TRIANGLE][i];
+		for (int k = 0; k < 3; k++) {
+			world[k] = node ? node->to_world(tri.points[k]) : tri.points[k];
+		}
+	});
+	reprojected += project_slots(VIS_SPHERE, geometry.num_spheres, 1, sphere_alive, sphere_points, [&](int i, V3* world) {
+		SPHERE& sph = geometry.spheres[i];
+		NODE* node = geometry.slot_node[VIS_SPHERE][i];
+		world[0] = node ? node->to_world(sph.point) : sph.point;
+	});
+
+	// project mesh vertices once, triangles index into them. only meshes /
+	// instances flagged dirty are projected again.
+	const int num_ranges = (int)(geometry.meshes.size() + geometry.instances.size());
+	bool rebuild = all || (int)mesh_source.size() != num_ranges;
+	// a moved instance can switch lod, which changes the range sizes.
+	for (int m = 0; MESH_LODS && !rebuild && m < num_ranges; m++) {
+		const int k = mesh_instance[m];
+		if (k >= 0 && geometry.instances[k].dirty) rebuild = select_lod(geometry.instances[k].mesh, k) != mesh_source[m];
+	}
+	// world space data (BVH, lighting) only goes stale when meshes move or
+	// the drawn set changes, the camera alone (or lod picks that stay) does not.
+	bool world_changed = geometry.meshes_changed;
+	geometry.meshes_changed = false;
+	if (rebuild) {
+		vector<MESH*> old_source = mesh_source;
+		vector<int> old_instance = mesh_instance;
+		build_mesh_ranges();
+		world_changed = world_changed || mesh_source != old_source || mesh_instance != old_instance;
+		range_stale.assign(num_ranges, 1);
+	}
+	for (int m = 0; !world_changed && m < num_ranges; m++) {
+		const int k = mesh_instance[m];
+		MESH* base = k < 0 ? geometry.meshes[m] : geometry.instances[k].mesh;
+		world_changed = base->dirty || (k >= 0 && geometry.instances[k].dirty);
+	}
+	if (world_changed) bvh_stale = true;
+	// cull first, whole ranges outside the frustum are not projected. they
+	// stay stale until a view that sees them.
+	vector<unsigned char> range_visible(num_ranges, 1);
+	if (BVH_CULLING && (all || world_changed)) cull_meshes();
+	for (int m = 0; BVH_CULLING && m < num_ranges; m++) {
+		const unsigned char* visible = tri_visible.data();
+		range_visible[m] = find(visible + mesh_tri_start[m], visible + mesh_tri_start[m + 1], 1) != visible + mesh_tri_start[m + 1];
+	}
+	// ranges project independently, slices of them as jobs. (ranges, vertices)
+	pair<int, int> projected = parallel_reduce(0, num_ranges, make_pair(0, 0), [&](int lo, int hi) {
+		pair<int, int> count(0, 0);
+		for (int m = lo; m < hi; m++) {
+			MESH* mesh = mesh_source[m];
+			const int k = mesh_instance[m];
+			MESH* base = k < 0 ? geometry.meshes[m] : geometry.instances[k].mesh;
+			const bool moved = base->dirty || (k >= 0 && geometry.instances[k].dirty);
+			if (!range_visible[m]) {
+				if (rebuild || moved) range_stale[m] = 1;
+				continue;
+			}
+			if (!rebuild && !moved && !range_stale[m]) continue;
+			range_stale[m] = 0;
+			V3* points = &mesh_points[mesh_vert_start[m]];
+			if (mesh->packed) {
+				M33 r = M33(1);
+				V3 t = V3(0.0f, 0.0f, 0.0f);
+				if (k >= 0) {
+					INSTANCE& inst = geometry.instances[k];
+					r = inst.rotation;
+					t = inst.translation;
+					if (inst.node) instanceToWorld(inst, r, t);
+					mesh_color[m] = tintColor(mesh->color, inst.tint);
+				}
+				project_packed(*mesh->packed, r, t, points);
+			}
+			else {
+				// instances: shared object space verts -> instance world space -> screen.
+				M33 r = M33(1);
+				V3 t = V3(0.0f, 0.0f, 0.0f);
+				if (k >= 0) {
+					INSTANCE& inst = geometry.instances[k];
+					r = inst.rotation;
+					t = inst.translation;
+					if (inst.node) instanceToWorld(inst, r, t);
+					mesh_color[m] = tintColor(mesh->color, inst.tint);
+				}
+				M33* rotation = k < 0 ? 0 : &r;
+				// big meshes split into vertex slices of their own.
+				if (mesh->num_verts < PROJECT_BATCH * 16) project_vertices(mesh->verts, mesh->num_verts, points, rotation, &t);
+				else parallel_for(0, mesh->num_verts, [&](int lo, int hi) {
+					project_vertices(mesh->verts + lo, hi - lo, points + lo, rotation, &t);
+				});
+			}
+			count.first++;
+			count.second += mesh->num_verts;
+		}
+		return count;
+	}, [](pair<int, int> a, pair<int, int> b) { return make_pair(a.first + b.first, a.second + b.second); });
+	reprojected += projected.second;
+	for (MESH* mesh : geometry.meshes) mesh->dirty = false;
+	for (INSTANCE& inst : geometry.instances) {
+		inst.mesh->dirty = false;
+		inst.dirty = false;
+	}
+
+	// directional lighting is in world space, independent of the camera.
+	if (GOURAUD_SHADING && world_changed) light_meshes();
+	sort_ms = 0.0;
+	if (SORT_PRIMITIVES && reprojected) sort_front_to_back();
+}
+
+// decode fused into projection. quantized q -> camera space is one affine
+// map, M_inv (r (lo + q scale) + t - C), so 4 vertices go from 16 bit loads
+// to projected points without materializing floats.
+void COMPUTED_GEOMETRY::project_packed(PACKED_MESH& packed, M33& r, V3& t, V3* out) {
+	PPC* ppc = scene->ppc;
+	M33& mi = ppc->M_inv;
+	float A[3][3], o[3];
+	float offset[3];
+	for (int d = 0; d < 3; d++) {
+		offset[d] = r[d][0] * packed.lo[0] + r[d][1] * packed.lo[1] + r[d][2] * packed.lo[2] + t[d] - ppc->C[d];
+	}
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			const float rj = mi[i][0] * r[0][j] + mi[i][1] * r[1][j] + mi[i][2] * r[2][j];
+			A[i][j] = rj * packed.scale[j];
+		}
+		o[i] = mi[i][0] * offset[0] + mi[i][1] * offset[1] + mi[i][2] * offset[2];
+	}
+
+	const __m128i zero = _mm_setzero_si128();
+	const unsigned short* qx = packed.pos.data();
+	const unsigned short* qy = qx + packed.stride;
+	const unsigned short* qz = qy + packed.stride;
+	float cam[3][4];
+	for (int i = 0; i < packed.num_verts; i += 4) {
+		// 4 x 16 bit -> 4 x float per axis
+		const __m128 x = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(qx + i)), zero));
+		const __m128 y = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(qy + i)), zero));
+		const __m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(qz + i)), zero));
+		for (int d = 0; d < 3; d++) {
+			const __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(A[d][0])), _mm_mul_ps(y, _mm_set1_ps(A[d][1]))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(A[d][2])), _mm_set1_ps(o[d])));
+			_mm_storeu_ps(cam[d], c);
+		}
+		const __m128 inv_z = _mm_div_ps(_mm_set1_ps(1.0f), _mm_loadu_ps(cam[2]));
+		_mm_storeu_ps(cam[0], _mm_mul_ps(_mm_loadu_ps(cam[0]), inv_z));
+		_mm_storeu_ps(cam[1], _mm_mul_ps(_mm_loadu_ps(cam[1]), inv_z));
+		const int n = min(4, packed.num_verts - i);
+		for (int j = 0; j < n; j++) out[i + j] = V3(cam[0][j], cam[1][j], cam[2][j]);
+	}
+}
+
+void COMPUTED_GEOMETRY::build_mesh_ranges() {
 	GEOMETRY& geometry = scene->geometry;
+	mesh_vert_start.clear();
+	mesh_tri_start.clear();
+	mesh_source.clear();
+	mesh_instance.clear();
+	mesh_color.clear();
+	int num_points = 0;
+	int num_mesh_tris = 0;
+	const int num_meshes = (int)geometry.meshes.size();
+	for (int m = 0; m < num_meshes + (int)geometry.instances.size(); m++) {
+		const int k = m < num_meshes ? -1 : m - num_meshes;
+		MESH* mesh = k < 0 ? geometry.meshes[m] : geometry.instances[k].mesh;
+		if (MESH_LODS) mesh = select_lod(mesh, k);
+		mesh_vert_start.push_back(num_points);
+		mesh_tri_start.push_back(num_mesh_tris);
+		mesh_source.push_back(mesh);
+		mesh_instance.push_back(k);
+		mesh_color.push_back(k < 0 ? mesh->color : tintColor(mesh->color, geometry.instances[k].tint));
+		num_points += mesh->num_verts;
+		num_mesh_tris += mesh->num_tris;
+	}
+	mesh_tri_start.push_back(num_mesh_tris);
+	mesh_points.resize(num_points);
+}
 
-	// rotate segments to showcase 3D.
-	for (int i = 0; i < geometry.num_segments; i++) {
-		SEGMENT& old_line = geometry.segments[i];
-		V3 new_start = transform(old_line.start);
-		V3 new_end = transform(old_line.end);
-		SEGMENT new_line = SEGMENT(new_start, new_end, old_line.color, old_line.width);
-		add_segment(new_line);
-	}
-
-	// rotate triangles. rotate each point, then pair spheres into segments
-	for (int i = 0; i < geometry.num_triangles; i++) {
-		TRIANGLE& triangle = geometry.triangles[i];
-		V3 p[3] = {
-			transform(triangle.points[0]),
-			transform(triangle.points[1]),
-			transform(triangle.points[2])
+// error (object units) / camera depth = error in pixels, the sphere center's
+// depth stands in for the whole mesh.
+MESH* COMPUTED_GEOMETRY::select_lod(MESH* mesh, int k) {
+	if (mesh->lods.empty()) return mesh;
+	PPC* ppc = scene->ppc;
+	V3 center = mesh->bound_center;
+	if (k >= 0) {
+		INSTANCE& inst = scene->geometry.instances[k];
+		M33 r = inst.rotation;
+		V3 t = inst.translation;
+		if (inst.node) instanceToWorld(inst, r, t);
+		V3& c = mesh->bound_center;
+		center = V3(r[0] * c + t[0], r[1] * c + t[1], r[2] * c + t[2]);
+	}
+	// nearest point of the bounding sphere, depth is in units of c . vd
+	V3 vd = ppc->GetVD();
+	V3 projected = ppc->Project(center);
+	const float depth = projected[Dim::Z] - mesh->bound_radius / (ppc->c * vd);
+	if (depth <= 0.0f) return mesh;
+	const float pixels_per_unit = 1.0f / (depth * ppc->a.length());
+	MESH* pick = mesh;
+	for (int l = 0; l < (int)mesh->lods.size(); l++) {
+		if (mesh->lod_error[l] * pixels_per_unit > LOD_PIXEL_ERROR) break;
+		pick = mesh->lods[l];
+	}
+	return pick;
+}
+
+// color = base * (ambient + (1 - ambient) * max(n . l, 0)), base from the
+// vertex colors when the mesh has them, else the flat mesh color.
+void COMPUTED_GEOMETRY::light_meshes() {
+	mesh_lit.resize(mesh_points.size());
+	const __m128 ambient = _mm_set1_ps(scene->ambient);
+	const __m128 diffuse = _mm_set1_ps(1.0f - scene->ambient);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (int m = 0; m < (int)mesh_source.size(); m++) {
+		MESH* mesh = mesh_source[m];
+		V3* out = &mesh_lit[mesh_vert_start[m]];
+		const float* n = (const float*)mesh->normals;
+		const float* c = (const float*)mesh->colors;
+		vector<V3> normals, colors;
+		if (mesh->packed) {
+			// decoded once per relight, not kept.
+			PACKED_MESH& p = *mesh->packed;
+			if (!p.normals.empty()) {
+				normals.resize(mesh->num_verts);
+				for (int i = 0; i < mesh->num_verts; i++) normals[i] = p.normal(i);
+				n = (const float*)normals.data();
+			}
+			if (!p.colors.empty()) {
+				colors.resize(mesh->num_verts);
+				for (int i = 0; i < mesh->num_verts; i++) colors[i] = p.color(i);
+				c = (const float*)colors.data();
+			}
+		}
+		const U32 color = mesh_color[m];
+		const float flat[3] = {
+			(float)(color & 255),
+			(float)((color >> 8) & 255),
+			(float)((color >> 16) & 255)
 		};
-		TRIANGLE new_tri = TRIANGLE(p, triangle.color, triangle.width);
-		add_triangle(new_tri);
-		/*SEGMENT s1 = SEGMENT(p[0], p[1], triangle.color, triangle.width);
-		SEGMENT s2 = SEGMENT(p[1], p[2], triangle.color, triangle.width);
-		SEGMENT s3 = SEGMENT(p[2], p[0], triangle.color, triangle.width);
-		add_segment(s1);
-		add_segment(s2);
-		add_segment(s3);*/
+		// instances: light in object space (R^T l) instead of rotating normals.
+		V3 l = scene->light_dir;
+		float tint[3] = { 255.0f, 255.0f, 255.0f };
+		if (mesh_instance[m] >= 0) {
+			INSTANCE& inst = scene->geometry.instances[mesh_instance[m]];
+			M33 r = inst.rotation;
+			V3 t = inst.translation;
+			if (inst.node) instanceToWorld(inst, r, t);
+			V3& wl = scene->light_dir;
+			l = V3(
+				r[0][0] * wl[0] + r[1][0] * wl[1] + r[2][0] * wl[2],
+				r[0][1] * wl[0] + r[1][1] * wl[1] + r[2][1] * wl[2],
+				r[0][2] * wl[0] + r[1][2] * wl[1] + r[2][2] * wl[2]);
+			for (int d = 0; d < 3; d++) tint[d] = (float)((inst.tint >> (8 * d)) & 255);
+		}
+		const __m128 lx = _mm_set1_ps(l[Dim::X]);
+		const __m128 ly = _mm_set1_ps(l[Dim::Y]);
+		const __m128 lz = _mm_set1_ps(l[Dim::Z]);
+
+		int i = 0;
+		for (; n && i + 4 <= mesh->num_verts; i += 4, n += 12) {
+			// gather 4 normals into x / y / z lanes
+			__m128 nx = _mm_setr_ps(n[0], n[3], n[6], n[9]);
+			__m128 ny = _mm_setr_ps(n[1], n[4], n[7], n[10]);
+			__m128 nz = _mm_setr_ps(n[2], n[5], n[8], n[11]);
+			__m128 ndotl = _mm_add_ps(_mm_mul_ps(nx, lx), _mm_add_ps(_mm_mul_ps(ny, ly), _mm_mul_ps(nz, lz)));
+			__m128 k = _mm_add_ps(ambient, _mm_mul_ps(diffuse, _mm_max_ps(ndotl, zero)));
+			float ks[4];
+			_mm_storeu_ps(ks, k);
+			for (int j = 0; j < 4; j++) {
+				for (int d = 0; d < 3; d++) {
+					out[i + j][d] = (c ? c[(i + j) * 3 + d] * tint[d] : flat[d]) * ks[j];
+				}
+			}
+		}
+		// tail (or unlit meshes without normals)
+		for (; i < mesh->num_verts; i++) {
+			float k = 1.0f;
+			if (n) {
+				const float ndotl = n[0] * l[Dim::X] + n[1] * l[Dim::Y] + n[2] * l[Dim::Z];
+				k = scene->ambient + (1.0f - scene->ambient) * max(ndotl, 0.0f);
+				n += 3;
+			}
+			for (int d = 0; d < 3; d++) {
+				out[i][d] = (c ? c[i * 3 + d] * tint[d] : flat[d]) * k;
+			}
+		}
+	}
+}
+
+bool COMPUTED_GEOMETRY::mesh_triangle(U32 t, TRIANGLE& tri, TRI_ATTRIBS* attr) {
+	// last mesh whose first triangle is <= t
+	const int m = (int)(upper_bound(mesh_tri_start.begin(), mesh_tri_start.end(), (int)t) - mesh_tri_start.begin()) - 1;
+	MESH* mesh = mesh_source[m];
+	const int first = (t - mesh_tri_start[m]) * 3;
+	const U32 idx[3] = { mesh->index(first), mesh->index(first + 1), mesh->index(first + 2) };
+	const int base = mesh_vert_start[m];
+	tri.points[0] = mesh_points[base + idx[0]];
+	tri.points[1] = mesh_points[base + idx[1]];
+	tri.points[2] = mesh_points[base + idx[2]];
+	tri.color = mesh_color[m];
+	tri.width = 1;
+
+	if (!attr) return false;
+	attr->lit = !mesh_lit.empty();
+	attr->texture = TEXTURE_MAPPING && mesh->tcs ? mesh->texture : 0;
+	for (int i = 0; i < 3; i++) {
+		if (attr->lit) attr->cols[i] = mesh_lit[base + idx[i]];
+		if (attr->texture) {
+			attr->uv[2 * i] = mesh->tcs[2 * idx[i]];
+			attr->uv[2 * i + 1] = mesh->tcs[2 * idx[i] + 1];
+		}
+		attr->q[i] = 1.0f / tri.points[i][Dim::Z];
 	}
+	return attr->lit || attr->texture;
+}
 
-	// rotate spheres.
-	for (int i = 0; i < geometry.num_spheres; i++) {
-		SPHERE& p3 = geometry.spheres[i];
-		V3 new_point = transform(p3.point);
-		SPHERE new_sphere = SPHERE(new_point, p3.color, p3.width);
-		add_sphere(new_sphere);
+void COMPUTED_GEOMETRY::world_triangles(vector<float>& verts, vector<U32>& ids) {
+	GEOMETRY& geometry = scene->geometry;
+	const int n = mesh_tri_start.empty() ? 0 : mesh_tri_start.back();
+	verts.resize(n * 9);
+	ids.resize(n);
+	for (int m = 0; m < (int)mesh_source.size(); m++) {
+		MESH* mesh = mesh_source[m];
+		const int k = mesh_instance[m];
+		M33 r = M33(1);
+		V3 t = V3(0.0f, 0.0f, 0.0f);
+		if (k >= 0) {
+			INSTANCE& inst = geometry.instances[k];
+			r = inst.rotation;
+			t = inst.translation;
+			if (inst.node) instanceToWorld(inst, r, t);
+		}
+		for (int i = 0; i < mesh->num_tris; i++) {
+			const int g = mesh_tri_start[m] + i;
+			float* out = &verts[g * 9];
+			for (int j = 0; j < 3; j++) {
+				V3 v = mesh->vertex(mesh->index(i * 3 + j));
+				for (int d = 0; d < 3; d++) {
+					out[j * 3 + d] = k < 0 ? v[d] : r[d] * v + t[d];
+				}
+			}
+			ids[g] = g;
+		}
 	}
 }
 
-// rotate + translate each V3 depending on perspective + origin. 
-inline V3& COMPUTED_GEOMETRY::transform(V3& v3) {
-	V3 res = scene->ppc->Project(v3);
-	return res;
+void COMPUTED_GEOMETRY::update_bvh() {
+	if (!bvh_stale) return;
+	vector<float> verts;
+	vector<U32> ids;
+	world_triangles(verts, ids);
+	bvh.build(verts, ids);
+	bvh_stale = false;
+}
+
+void COMPUTED_GEOMETRY::cull_meshes() {
+	update_bvh();
+	float planes[5 * 4];
+	scene->ppc->GetFrustumPlanes(planes);
+
+	vector<U32> visible;
+	bvh.cull(planes, 5, visible);
+	const int n = mesh_tri_start.empty() ? 0 : mesh_tri_start.back();
+	tri_visible.assign(n, 0);
+	for (U32 t : visible) tri_visible[t] = 1;
+	culled = n - (int)visible.size();
+}
+
+// ray through the pixel's sample point (integer u, v, as the rasterizers
+// cover pixels) from the eye, nearest world space hit.
+U32 COMPUTED_GEOMETRY::pick(float u, float v) {
+	update_bvh();
+	PPC* ppc = scene->ppc;
+	float origin[3], dir[3];
+	for (int d = 0; d < 3; d++) {
+		origin[d] = ppc->C[d];
+		dir[d] = ppc->a[d] * u + ppc->b[d] * v + ppc->c[d];
+	}
+	float t_max = FLT_MAX;
+	return bvh.intersect(origin, dir, t_max);
+}
+
+void COMPUTED_GEOMETRY::sort_front_to_back() {
+	auto t1 = chrono::high_resolution_clock::now();
+
+	const int num_mesh_tris = mesh_tri_start.empty() ? 0 : mesh_tri_start.back();
+	const int n = num_segments + num_spheres + num_triangles + num_mesh_tris;
+	order.resize(n);
+	vector<U32> keys(n), tmp_keys(n), tmp_order(n);
+
+	int k = 0;
+	for (int i = 0; i < num_segments; i++) {
+		if (!segment_alive[i]) continue;
+		keys[k] = float_to_key(min(segment_points.z[2 * i], segment_points.z[2 * i + 1]));
+		order[k++] = VIS_ID(VIS_SEGMENT, i);
+	}
+	for (int i = 0; i < num_spheres; i++) {
+		if (!sphere_alive[i]) continue;
+		keys[k] = float_to_key(sphere_points.z[i]);
+		order[k++] = VIS_ID(VIS_SPHERE, i);
+	}
+	for (int i = 0; i < num_triangles; i++) {
+		if (!triangle_alive[i]) continue;
+		const float* z = &triangle_points.z[3 * i];
+		keys[k] = float_to_key(min3(z[0], z[1], z[2]));
+		order[k++] = VIS_ID(VIS_TRIANGLE, i);
+	}
+	for (int m = 0; m < (int)mesh_source.size(); m++) {
+		MESH* mesh = mesh_source[m];
+		V3* p = &mesh_points[mesh_vert_start[m]];
+		for (int i = 0; i < mesh->num_tris; i++) {
+			if (BVH_CULLING && !tri_visible[mesh_tri_start[m] + i]) continue;
+			const U32 idx[3] = { mesh->index(i * 3), mesh->index(i * 3 + 1), mesh->index(i * 3 + 2) };
+			keys[k] = float_to_key(min3(p[idx[0]][Dim::Z], p[idx[1]][Dim::Z], p[idx[2]][Dim::Z]));
+			order[k++] = VIS_ID(VIS_MESH, mesh_tri_start[m] + i);
+		}
+	}
+	// removed slots (and culled triangles) were skipped.
+	order.resize(k);
+	radix_sort(keys.data(), order.data(), tmp_keys.data(), tmp_order.data(), k);
+
+	auto t2 = chrono::high_resolution_clock::now();
+	sort_ms = chrono::duration<double, milli>(t2 - t1).count();
+}
+
+// PPC::Project over x / y / z arrays, same arithmetic 4 points at a time.
+void COMPUTED_GEOMETRY::project_points(const float* x, const float* y, const float* z, int n, float* ox, float* oy, float* oz) {
+	PPC* ppc = scene->ppc;
+	M33& mi = ppc->M_inv;
+	__m128 row[3][3];
+	for (int d = 0; d < 3; d++) {
+		for (int j = 0; j < 3; j++) row[d][j] = _mm_set1_ps(mi[d][j]);
+	}
+	const __m128 cx = _mm_set1_ps(ppc->C[Dim::X]);
+	const __m128 cy = _mm_set1_ps(ppc->C[Dim::Y]);
+	const __m128 cz = _mm_set1_ps(ppc->C[Dim::Z]);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), cx);
+		const __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), cy);
+		const __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), cz);
+		__m128 cam[3];
+		for (int d = 0; d < 3; d++) {
+			cam[d] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[d][0], dx), _mm_mul_ps(row[d][1], dy)), _mm_mul_ps(row[d][2], dz));
+		}
+		const __m128 inv_z = _mm_div_ps(_mm_set1_ps(1.0f), cam[2]);
+		_mm_storeu_ps(ox + i, _mm_mul_ps(cam[0], inv_z));
+		_mm_storeu_ps(oy + i, _mm_mul_ps(cam[1], inv_z));
+		_mm_storeu_ps(oz + i, cam[2]);
+	}
+	for (; i < n; i++) {
+		V3 p = V3(x[i], y[i], z[i]);
+		V3 q = ppc->Project(p);
+		ox[i] = q[Dim::X];
+		oy[i] = q[Dim::Y];
+		oz[i] = q[Dim::Z];
+	}
+}
+
+void COMPUTED_GEOMETRY::project_vertices(V3* in, int n, V3* out, M33* r, V3* t) {
+	float wx[PROJECT_BATCH], wy[PROJECT_BATCH], wz[PROJECT_BATCH];
+	float px[PROJECT_BATCH], py[PROJECT_BATCH], pz[PROJECT_BATCH];
+	for (int i = 0; i < n; i += PROJECT_BATCH) {
+		const int count = min(PROJECT_BATCH, n - i);
+		for (int j = 0; j < count; j++) {
+			V3& v = in[i + j];
+			if (r) {
+				M33& m = *r;
+				wx[j] = m[0] * v + (*t)[0];
+				wy[j] = m[1] * v + (*t)[1];
+				wz[j] = m[2] * v + (*t)[2];
+			}
+			else {
+				wx[j] = v[Dim::X];
+				wy[j] = v[Dim::Y];
+				wz[j] = v[Dim::Z];
+			}
+		}
+		project_points(wx, wy, wz, count, px, py, pz);
+		for (int j = 0; j < count; j++) out[i + j] = V3(px[j], py[j], pz[j]);
+	}
 }
 
-inline void COMPUTED_GEOMETRY::add_segment(SEGMENT& seg) {
-	segments[num_segments++] = seg;
+inline SEGMENT COMPUTED_GEOMETRY::segment(int i) {
+	SEGMENT& src = scene->geometry.segments[i];
+	V3 start = segment_points.point(2 * i);
+	V3 end = segment_points.point(2 * i + 1);
+	return SEGMENT(start, end, src.color, src.width);
 }
 
-inline void COMPUTED_GEOMETRY::add_sphere(SPHERE& sph) {
-	spheres[num_spheres++] = sph;
+inline SPHERE COMPUTED_GEOMETRY::sphere(int i) {
+	SPHERE& src = scene->geometry.spheres[i];
+	V3 point = sphere_points.point(i);
+	return SPHERE(point, src.color, src.width);
 }
 
-inline void COMPUTED_GEOMETRY::add_triangle(TRIANGLE& tri) {
-	triangles[num_triangles++] = tri;
+inline TRIANGLE COMPUTED_GEOMETRY::triangle(int i) {
+	TRIANGLE& src = scene->geometry.triangles[i];
+	V3 points[3] = { triangle_points.point(3 * i), triangle_points.point(3 * i + 1), triangle_points.point(3 * i + 2) };
+	return TRIANGLE(points, src.color, src.width);
 }
\ No newline at end of file
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "MeshOptimize.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+float mesh_acmr(MESH& mesh, int cache_size) {
+	if (!mesh.num_tris) return 0.0f;
+	// a vertex is cached while fewer than cache_size misses followed its own
+	vector<int> stamp(mesh.num_verts, -1);
+	int misses = 0, time = 0;
+	for (int i = 0; i < mesh.num_tris * 3; i++) {
+		const int v = mesh.tris[i];
+		if (stamp[v] >= 0 && time - stamp[v] < cache_size) continue;
+		misses++;
+		stamp[v] = time++;
+	}
+	return (float)misses / mesh.num_tris;
+}
+
+// spread the low 10 bits of x to every third bit.
+static inline U32 part1by2(U32 x) {
+	x &= 0x3FF;
+	x = (x | (x << 16)) & 0xFF0000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+void spatial_order(MESH& mesh, vector<int>& order) {
+	const int n = mesh.num_tris;
+	order.resize(n);
+	if (!n) return;
+	V3 lo = mesh.vertex(0), hi = lo;
+	for (int i = 1; i < mesh.num_verts; i++) {
+		V3 v = mesh.vertex(i);
+		for (int d = 0; d < 3; d++) {
+			lo[d] = min(lo[d], v[d]);
+			hi[d] = max(hi[d], v[d]);
+		}
+	}
+	float scale[3];
+	for (int d = 0; d < 3; d++) scale[d] = hi[d] > lo[d] ? 1023.0f / (3.0f * (hi[d] - lo[d])) : 0.0f;
+	vector<U32> codes(n);
+	for (int t = 0; t < n; t++) {
+		V3 p[3] = { mesh.vertex(mesh.index(t * 3)), mesh.vertex(mesh.index(t * 3 + 1)), mesh.vertex(mesh.index(t * 3 + 2)) };
+		U32 q[3];
+		for (int d = 0; d < 3; d++) {
+			q[d] = (U32)((p[0][d] + p[1][d] + p[2][d] - 3.0f * lo[d]) * scale[d]);
+		}
+		codes[t] = part1by2(q[0]) | (part1by2(q[1]) << 1) | (part1by2(q[2]) << 2);
+		order[t] = t;
+	}
+	stable_sort(order.begin(), order.end(), [&codes](int a, int b) { return codes[a] < codes[b]; });
+}
+
+void sort_triangles_spatially(MESH& mesh) {
+	vector<int> order;
+	spatial_order(mesh, order);
+	vector<U32> tris(mesh.tris, mesh.tris + mesh.num_tris * 3);
+	for (int t = 0; t < mesh.num_tris; t++) {
+		for (int i = 0; i < 3; i++) mesh.tris[t * 3 + i] = tris[order[t] * 3 + i];
+	}
+}
+
+// Forsyth's vertex score: recently used and low remaining valence is better.
+static inline float vertexScore(int cache_pos, int valence) {
+	if (valence == 0) return -1.0f;
+	float score = 0.0f;
+	if (cache_pos >= 0) {
+		// the last triangle's vertices get a fixed score, so it doesn't
+		// matter which one it used first
+		if (cache_pos < 3) score = 0.75f;
+		else score = pow(1.0f - (cache_pos - 3) / (float)(VCACHE_SIZE - 3), 1.5f);
+	}
+	return score + 2.0f / sqrt((float)valence);
+}
+
+void optimize_vertex_cache(MESH& mesh) {
+	const int nv = mesh.num_verts, nt = mesh.num_tris;
+	if (!nt) return;
+	// per vertex list of not yet emitted triangles (CSR, shrinks in place)
+	vector<int> valence(nv, 0), first(nv + 1, 0), vert_tris(nt * 3);
+	for (int i = 0; i < nt * 3; i++) valence[mesh.tris[i]]++;
+	for (int v = 0; v < nv; v++) first[v + 1] = first[v] + valence[v];
+	vector<int> fill_pos(first.begin(), first.end() - 1);
+	for (int i = 0; i < nt * 3; i++) vert_tris[fill_pos[mesh.tris[i]]++] = i / 3;
+
+	vector<int> cache_pos(nv, -1);
+	vector<float> vscore(nv), tscore(nt, 0.0f);
+	vector<bool> emitted(nt, false);
+	for (int v = 0; v < nv; v++) vscore[v] = vertexScore(-1, valence[v]);
+	for (int t = 0; t < nt; t++) {
+		for (int i = 0; i < 3; i++) tscore[t] += vscore[mesh.tris[t * 3 + i]];
+	}
+
+	vector<U32> out(nt * 3);
+	vector<int> cache, next_cache;
+	int scan = 0; // next triangle to fall back to, in input order
+	int best = -1;
+	for (int k = 0; k < nt; k++) {
+		if (best < 0) {
+			// nothing cached scores: continue with the next unused triangle
+			while (emitted[scan]) scan++;
+			best = scan;
+		}
+		const U32* idx = mesh.tris + best * 3;
+		emitted[best] = true;
+		for (int i = 0; i < 3; i++) out[k * 3 + i] = idx[i];
+
+		// drop best from its vertices' lists
+		for (int i = 0; i < 3; i++) {
+			const int v = idx[i];
+			int* list = &vert_tris[first[v]];
+			for (int j = 0; j < valence[v]; j++) {
+				if (list[j] == best) {
+					list[j] = list[valence[v] - 1];
+					break;
+				}
+			}
+			valence[v]--;
+		}
+		// best's vertices move to the front of the lru cache
+		next_cache.assign(idx, idx + 3);
+		for (int v : cache) {
+			if (v != (int)idx[0] && v != (int)idx[1] && v != (int)idx[2]) next_cache.push_back(v);
+		}
+		for (int v : cache) cache_pos[v] = -1;
+		for (int i = 0; i < (int)next_cache.size(); i++) {
+			cache_pos[next_cache[i]] = i < VCACHE_SIZE ? i : -1;
+		}
+		// rescore everything that was or is cached, pick the best triangle
+		// among the cached vertices' remaining ones.
+		float best_score = -1.0f;
+		best = -1;
+		for (int v : next_cache) {
+			const float old_score = vscore[v];
+			vscore[v] = vertexScore(cache_pos[v], valence[v]);
+			const float delta = vscore[v] - old_score;
+			for (int j = 0; j < valence[v]; j++) tscore[vert_tris[first[v] + j]] += delta;
+		}
+		if (next_cache.size() > VCACHE_SIZE) next_cache.resize(VCACHE_SIZE);
+		for (int v : next_cache) {
+			for (int j = 0; j < valence[v]; j++) {
+				const int t = vert_tris[first[v] + j];
+				if (tscore[t] > best_score) {
+					best_score = tscore[t];
+					best = t;
+				}
+			}
+		}
+		cache.swap(next_cache);
+	}
+	copy(out.begin(), out.end(), mesh.tris);
+}
+
+void optimize_vertex_fetch(MESH& mesh) {
+	const int nv = mesh.num_verts;
+	vector<int> remap(nv, -1);
+	int next = 0;
+	for (int i = 0; i < mesh.num_tris * 3; i++) {
+		if (remap[mesh.tris[i]] < 0) remap[mesh.tris[i]] = next++;
+	}
+	// unreferenced vertices go last
+	for (int v = 0; v < nv; v++) {
+		if (remap[v] < 0) remap[v] = next++;
+	}
+	for (int i = 0; i < mesh.num_tris * 3; i++) mesh.tris[i] = remap[mesh.tris[i]];
+
+	vector<V3> tmp(nv);
+	for (V3* attr : { mesh.verts, mesh.colors, mesh.normals }) {
+		if (!attr) continue;
+		for (int v = 0; v < nv; v++) tmp[remap[v]] = attr[v];
+		copy(tmp.begin(), tmp.end(), attr);
+	}
+	if (mesh.tcs) {
+		vector<float> tcs(nv * 2);
+		for (int v = 0; v < nv; v++) {
+			tcs[remap[v] * 2] = mesh.tcs[v * 2];
+			tcs[remap[v] * 2 + 1] = mesh.tcs[v * 2 + 1];
+		}
+		copy(tcs.begin(), tcs.end(), mesh.tcs);
+	}
+}
+
+void MESH::Optimize() {
+	if (!num_tris || packed) return;
+	auto t1 = chrono::high_resolution_clock::now();
+	const float before = mesh_acmr(*this);
+	sort_triangles_spatially(*this);
+	optimize_vertex_cache(*this);
+	optimize_vertex_fetch(*this);
+	auto t2 = chrono::high_resolution_clock::now();
+	cout << "vertex cache reorder (" << chrono::duration<double, milli>(t2 - t1).count()
+		<< " ms): ACMR " << before << " -> " << mesh_acmr(*this) << "\n";
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Parallel.hpp"
+
+#include <chrono>
+
+static thread_local int job_queue_index = 0; // workers are 1.., everyone else shares 0
+
+JOB_SYSTEM& job_system() {
+	static JOB_SYSTEM jobs;
+	return jobs;
+}
+
+JOB_SYSTEM::JOB_SYSTEM() : queued(0), in_flight(0), quit(false), tasks(0), steals(0), idle_us(0) {
+	const int n = max(1, (int)thread::hardware_concurrency());
+	for (int i = 0; i < n; i++) queues.push_back(new JOB_QUEUE());
+	for (int i = 1; i < n; i++) workers.push_back(thread([this, i] { worker_main(i); }));
+}
+
+JOB_SYSTEM::~JOB_SYSTEM() {
+	{
+		lock_guard<mutex> guard(sleep_lock);
+		quit = true;
+	}
+	wake.notify_all();
+	for (thread& t : workers) t.join();
+	for (JOB_QUEUE* q : queues) delete q;
+}
+
+void JOB_SYSTEM::push(atomic<int>& pending, function<void()> fn) {
+	pending++;
+	in_flight++;
+	JOB_QUEUE* q = queues[job_queue_index];
+	{
+		lock_guard<mutex> guard(q->lock);
+		q->jobs.push_back(JOB{ move(fn), &pending });
+	}
+	queued++;
+	{
+		lock_guard<mutex> guard(sleep_lock);
+	}
+	wake.notify_one();
+}
+
+// newest job of our own deque, else the oldest of someone else's.
+bool JOB_SYSTEM::run_one(int self) {
+	if (queued <= 0) return false;
+	JOB job;
+	bool found = false;
+	const int n = (int)queues.size();
+	for (int k = 0; k < n && !found; k++) {
+		JOB_QUEUE* q = queues[(self + k) % n];
+		lock_guard<mutex> guard(q->lock);
+		if (q->jobs.empty()) continue;
+		if (k == 0) {
+			job = move(q->jobs.back());
+			q->jobs.pop_back();
+		}
+		else {
+			job = move(q->jobs.front());
+			q->jobs.pop_front();
+			steals++;
+		}
+		found = true;
+	}
+	if (!found) return false;
+	queued--;
+	job.fn();
+	tasks++;
+	(*job.pending)--;
+	in_flight--;
+	return true;
+}
+
+void JOB_SYSTEM::wait(atomic<int>& pending) {
+	while (pending > 0) {
+		if (run_one(job_queue_index)) continue;
+		// our jobs are running elsewhere.
+		auto t1 = chrono::high_resolution_clock::now();
+		this_thread::yield();
+		auto t2 = chrono::high_resolution_clock::now();
+		idle_us += chrono::duration_cast<chrono::microseconds>(t2 - t1).count();
+	}
+}
+
+void JOB_SYSTEM::worker_main(int self) {
+	job_queue_index = self;
+	while (!quit) {
+		if (run_one(self)) continue;
+		// idle only counts while others still run jobs, sampled at 1 ms so
+		// the gap between frames is not included.
+		const bool busy = in_flight > 0;
+		auto t1 = chrono::high_resolution_clock::now();
+		{
+			unique_lock<mutex> guard(sleep_lock);
+			if (busy) wake.wait_for(guard, chrono::milliseconds(1), [this] { return quit || queued > 0; });
+			else wake.wait(guard, [this] { return quit || queued > 0; });
+		}
+		if (busy) {
+			auto t2 = chrono::high_resolution_clock::now();
+			idle_us += chrono::duration_cast<chrono::microseconds>(t2 - t1).count();
+		}
+	}
+}
+
+JOB_STATS JOB_SYSTEM::stats() {
+	JOB_STATS s;
+	s.tasks = tasks;
+	s.steals = steals;
+	s.idle_ms = idle_us / 1000.0;
+	return s;
+}
+
+void JOB_SYSTEM::reset_stats() {
+	tasks = 0;
+	steals = 0;
+	idle_us = 0;
+}
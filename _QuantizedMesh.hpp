@@ -0,0 +1,145 @@
+#pragma once
+
+#include "QuantizedMesh.hpp"
+#include "Geometry.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+static inline float signNotZero(float v) {
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// project onto the octahedron |x| + |y| + |z| = 1, fold the lower half out.
+U32 oct_encode(V3& n) {
+	const float l1 = fabs(n[0]) + fabs(n[1]) + fabs(n[2]);
+	if (l1 == 0.0f) return 0x7FFF7FFF;
+	float x = n[0] / l1, y = n[1] / l1;
+	if (n[2] < 0.0f) {
+		const float fx = (1.0f - fabs(y)) * signNotZero(x);
+		const float fy = (1.0f - fabs(x)) * signNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	const U32 u = (U32)floor((x * 0.5f + 0.5f) * 65535.0f + 0.5f);
+	const U32 v = (U32)floor((y * 0.5f + 0.5f) * 65535.0f + 0.5f);
+	return u | (v << 16);
+}
+
+V3 oct_decode(U32 e) {
+	float x = (e & 0xFFFF) / 65535.0f * 2.0f - 1.0f;
+	float y = (e >> 16) / 65535.0f * 2.0f - 1.0f;
+	const float z = 1.0f - fabs(x) - fabs(y);
+	if (z < 0.0f) {
+		const float fx = (1.0f - fabs(y)) * signNotZero(x);
+		const float fy = (1.0f - fabs(x)) * signNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	V3 n = V3(x, y, z);
+	n.normalize();
+	return n;
+}
+
+inline U32 PACKED_MESH::index(int i) {
+	if (!wide_tris.empty()) return wide_tris[i];
+	return block_base[i / (3 * PACKED_BLOCK)] + offsets[i];
+}
+
+inline V3 PACKED_MESH::position(int i) {
+	return V3(
+		lo[0] + pos[i] * scale[0],
+		lo[1] + pos[stride + i] * scale[1],
+		lo[2] + pos[2 * stride + i] * scale[2]);
+}
+
+inline V3 PACKED_MESH::normal(int i) {
+	return oct_decode(normals[i]);
+}
+
+inline V3 PACKED_MESH::color(int i) {
+	const U32 c = colors[i];
+	const float s = 1.0f / 255.0f;
+	return V3((c & 255) * s, ((c >> 8) & 255) * s, ((c >> 16) & 255) * s);
+}
+
+inline U32 MESH::index(int i) {
+	return packed ? packed->index(i) : tris[i];
+}
+
+inline V3 MESH::vertex(int i) {
+	return packed ? packed->position(i) : verts[i];
+}
+
+size_t PACKED_MESH::bytes() {
+	return pos.size() * sizeof(pos[0]) + normals.size() * sizeof(U32) + colors.size() * sizeof(U32)
+		+ block_base.size() * sizeof(U32) + offsets.size() * sizeof(offsets[0]) + wide_tris.size() * sizeof(U32);
+}
+
+void MESH::Pack() {
+	for (MESH* lod : lods) lod->Pack();
+	if (packed || !num_verts) return;
+	const size_t old_bytes = num_verts * sizeof(V3) * (1 + (colors != 0) + (normals != 0)) + num_tris * 3 * sizeof(U32);
+	PACKED_MESH* p = new PACKED_MESH();
+	p->num_verts = num_verts;
+	p->num_tris = num_tris;
+	p->stride = (num_verts + 3) & ~3;
+
+	V3 lo = verts[0], hi = verts[0];
+	for (int i = 1; i < num_verts; i++) {
+		for (int d = 0; d < 3; d++) {
+			lo[d] = min(lo[d], verts[i][d]);
+			hi[d] = max(hi[d], verts[i][d]);
+		}
+	}
+	p->pos.assign(p->stride * 3, 0);
+	for (int d = 0; d < 3; d++) {
+		p->lo[d] = lo[d];
+		p->scale[d] = hi[d] > lo[d] ? (hi[d] - lo[d]) / 65535.0f : 0.0f;
+		const float inv = hi[d] > lo[d] ? 65535.0f / (hi[d] - lo[d]) : 0.0f;
+		for (int i = 0; i < num_verts; i++) {
+			p->pos[d * p->stride + i] = (unsigned short)floor((verts[i][d] - lo[d]) * inv + 0.5f);
+		}
+	}
+	if (normals) {
+		p->normals.resize(num_verts);
+		for (int i = 0; i < num_verts; i++) p->normals[i] = oct_encode(normals[i]);
+	}
+	if (colors) {
+		p->colors.resize(num_verts);
+		for (int i = 0; i < num_verts; i++) {
+			U32 rgb[3];
+			for (int d = 0; d < 3; d++) rgb[d] = (U32)(max(0.0f, min(colors[i][d], 1.0f)) * 255.0f + 0.5f);
+			p->colors[i] = COLOR(rgb[0], rgb[1], rgb[2]);
+		}
+	}
+	// block delta indices, plain ones if any block spans too much
+	const int n = num_tris * 3;
+	for (int b = 0; b < n; b += 3 * PACKED_BLOCK) {
+		const int end = min(n, b + 3 * PACKED_BLOCK);
+		const U32 base = *min_element(tris + b, tris + end);
+		const U32 top = *max_element(tris + b, tris + end);
+		if (top - base > 0xFFFF) {
+			p->block_base.clear();
+			p->offsets.clear();
+			p->wide_tris.assign(tris, tris + n);
+			break;
+		}
+		p->block_base.push_back(base);
+		for (int i = b; i < end; i++) p->offsets.push_back((unsigned short)(tris[i] - base));
+	}
+
+	delete[] verts;
+	delete[] normals;
+	delete[] colors;
+	delete[] tris;
+	verts = 0;
+	normals = 0;
+	colors = 0;
+	tris = 0;
+	packed = p;
+	cout << "packed mesh: " << old_bytes / 1024 << " KB -> " << p->bytes() / 1024 << " KB"
+		<< (p->wide_tris.empty() ? "" : " (indices unpacked)") << "\n";
+}
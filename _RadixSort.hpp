@@ -0,0 +1,89 @@
+#pragma once
+
+#include "RadixSort.hpp"
+
+#include <cstring>
+#include <vector>
+#include <thread>
+
+#include "Parallel.hpp"
+
+using namespace std;
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PARALLEL_MIN (1 << 14) // below this, threads cost more than they save
+
+inline U32 float_to_key(float f) {
+	U32 u;
+	memcpy(&u, &f, sizeof(U32));
+	// negative: flip all bits, positive: flip sign bit
+	return u ^ ((U32)(-(int)(u >> 31)) | 0x80000000);
+}
+
+void radix_sort(U32* keys, U32* vals, U32* tmp_keys, U32* tmp_vals, int n) {
+	if (n <= 1) return;
+
+	int chunks = 1;
+	if (n >= RADIX_PARALLEL_MIN) {
+		chunks = (int)thread::hardware_concurrency();
+		if (chunks < 1) chunks = 1;
+	}
+	const int chunk_size = (n + chunks - 1) / chunks;
+	// one histogram / offset table per chunk keeps the scatter stable.
+	vector<U32> counts(chunks * RADIX_BUCKETS);
+
+	U32* src_k = keys; U32* src_v = vals;
+	U32* dst_k = tmp_keys; U32* dst_v = tmp_vals;
+	for (int shift = 0; shift < 32; shift += RADIX_BITS) {
+		fill(counts.begin(), counts.end(), 0);
+
+		// histogram each chunk
+		parallel_for(0, chunks, [&](int lo, int hi) {
+			for (int c = lo; c < hi; c++) {
+				U32* count = &counts[c * RADIX_BUCKETS];
+				const int end = min(n, (c + 1) * chunk_size);
+				for (int i = c * chunk_size; i < end; i++) {
+					count[(src_k[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+				}
+			}
+		});
+
+		// exclusive prefix sum, digit major then chunk.
+		U32 sum = 0;
+		bool skip = false;
+		for (int d = 0; d < RADIX_BUCKETS; d++) {
+			const U32 digit_start = sum;
+			for (int c = 0; c < chunks; c++) {
+				U32 count = counts[c * RADIX_BUCKETS + d];
+				counts[c * RADIX_BUCKETS + d] = sum;
+				sum += count;
+			}
+			// every key shares this digit, pass would be a copy.
+			if (sum - digit_start == (U32)n) skip = true;
+		}
+		if (skip) continue;
+
+		// scatter each chunk to its reserved ranges
+		parallel_for(0, chunks, [&](int lo, int hi) {
+			for (int c = lo; c < hi; c++) {
+				U32* offset = &counts[c * RADIX_BUCKETS];
+				const int end = min(n, (c + 1) * chunk_size);
+				for (int i = c * chunk_size; i < end; i++) {
+					U32 o = offset[(src_k[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+					dst_k[o] = src_k[i];
+					dst_v[o] = src_v[i];
+				}
+			}
+		});
+
+		swap(src_k, dst_k);
+		swap(src_v, dst_v);
+	}
+
+	// odd number of applied passes leaves the result in the scratch buffers
+	if (src_k != keys) {
+		memcpy(keys, src_k, n * sizeof(U32));
+		memcpy(vals, src_v, n * sizeof(U32));
+	}
+}
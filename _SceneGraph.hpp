@@ -0,0 +1,63 @@
+#pragma once
+
+#include "SceneGraph.hpp"
+
+#include <cstring>
+
+#include "scene.h"
+
+NODE::NODE() {}
+
+NODE::~NODE() {
+	for (NODE* child : children) delete child;
+}
+
+NODE* NODE::add_child() {
+	NODE* child = new NODE();
+	child->parent = this;
+	children.push_back(child);
+	return child;
+}
+
+void NODE::set_rotation(M33 r) {
+	if (memcmp(&r, &rotation, sizeof(r)) == 0) return;
+	rotation = r;
+	dirty = true;
+}
+
+void NODE::set_translation(V3 t) {
+	if (memcmp(&t, &translation, sizeof(t)) == 0) return;
+	translation = t;
+	dirty = true;
+}
+
+inline V3 NODE::to_world(V3& p) {
+	M33& r = world_rotation;
+	V3& t = world_translation;
+	return V3(r[0] * p + t[0], r[1] * p + t[1], r[2] * p + t[2]);
+}
+
+void NODE::update(bool parent_moved) {
+	const bool moved = dirty || parent_moved;
+	if (moved) {
+		dirty = false;
+		if (parent) {
+			// world = parent world * local
+			M33& pr = parent->world_rotation;
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++) {
+					world_rotation[i][j] = pr[i][0] * rotation[0][j] + pr[i][1] * rotation[1][j] + pr[i][2] * rotation[2][j];
+				}
+			}
+			world_translation = parent->to_world(translation);
+		}
+		else {
+			world_rotation = rotation;
+			world_translation = translation;
+		}
+		GEOMETRY& geometry = scene->geometry;
+		for (U32 handle : handles) geometry.mark_dirty(handle);
+		for (int i : instances) geometry.instances[i].dirty = true;
+	}
+	for (NODE* child : children) child->update(moved);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Shadow.hpp"
+#include "Geometry.hpp" // min3 / max3
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+
+SHADOW_MAP::SHADOW_MAP(int _size) : size(_size) {
+	ppc = new PPC(SHADOW_FOV, size, size);
+	depth.resize(size * size, 0.0f);
+}
+
+SHADOW_MAP::~SHADOW_MAP() {
+	delete ppc;
+}
+
+bool SHADOW_MAP::render(BVH& casters, V3 light_dir) {
+	if (casters.builds == rendered_build && memcmp(&rendered_light, &light_dir, sizeof(V3)) == 0) {
+		render_ms = 0.0;
+		return false;
+	}
+	auto t1 = chrono::high_resolution_clock::now();
+	rendered_build = casters.builds;
+	rendered_light = light_dir;
+	fill(depth.begin(), depth.end(), 0.0f);
+	triangles = 0;
+
+	if (!casters.empty()) {
+		// aim at the casters' bounding sphere from 3 radii away along the light.
+		BVH_NODE& root = casters.nodes[0];
+		V3 center = V3(
+			(root.lo[0] + root.hi[0]) * 0.5f,
+			(root.lo[1] + root.hi[1]) * 0.5f,
+			(root.lo[2] + root.hi[2]) * 0.5f);
+		V3 half = V3(root.hi[0] - center[0], root.hi[1] - center[1], root.hi[2] - center[2]);
+		const float radius = max(half.length(), 1e-3f);
+		V3 eye = V3(
+			center[0] + light_dir[0] * 3.0f * radius,
+			center[1] + light_dir[1] * 3.0f * radius,
+			center[2] + light_dir[2] * 3.0f * radius);
+		V3 up = fabs(light_dir[1]) > 0.99f ? V3(1.0f, 0.0f, 0.0f) : V3(0.0f, 1.0f, 0.0f);
+		ppc->SetPose(eye, center, up);
+
+		const int n = (int)casters.ids.size();
+		for (int i = 0; i < n; i++) {
+			const float* v = &casters.verts[i * 9];
+			V3 p[3];
+			for (int k = 0; k < 3; k++) {
+				V3 world = V3(v[k * 3], v[k * 3 + 1], v[k * 3 + 2]);
+				p[k] = ppc->Project(world);
+			}
+			rasterDepth(p);
+		}
+	}
+	auto t2 = chrono::high_resolution_clock::now();
+	render_ms = chrono::duration<double, milli>(t2 - t1).count();
+	return true;
+}
+
+// depth only triangle: no color, ids or depth test branches. 4 texels per
+// step, coverage as an SSE mask, max() keeps the nearest 1 / z.
+void SHADOW_MAP::rasterDepth(V3* p) {
+	float x[3], y[3], q[3];
+	for (int i = 0; i < 3; i++) {
+		x[i] = p[i][Dim::X];
+		y[i] = p[i][Dim::Y];
+		// 1 / z is linear in screen space
+		q[i] = 1.0f / p[i][Dim::Z];
+	}
+	const float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (area == 0.0f || p[0][Dim::Z] <= 0.0f || p[1][Dim::Z] <= 0.0f || p[2][Dim::Z] <= 0.0f) return;
+
+	const int min_x = max(0, (int)floor(min3(x[0], x[1], x[2]))) & ~3;
+	const int min_y = max(0, (int)floor(min3(y[0], y[1], y[2])));
+	const int max_x = min(size - 1, (int)ceil(max3(x[0], x[1], x[2])));
+	const int max_y = min(size - 1, (int)ceil(max3(y[0], y[1], y[2])));
+	if (min_x > max_x || min_y > max_y) return;
+	triangles++;
+
+	// barycentric b_i = A_i x + B_i y + C_i (edge opposite vertex i / area),
+	// >= 0 inside for either winding. 1 / z = QA x + QB y + QC.
+	const float inv_area = 1.0f / area;
+	float A[3], B[3], C[3];
+	float QA = 0.0f, QB = 0.0f, QC = 0.0f;
+	for (int i = 0; i < 3; i++) {
+		const int j = (i + 1) % 3, k = (i + 2) % 3;
+		A[i] = -(y[k] - y[j]) * inv_area;
+		B[i] = (x[k] - x[j]) * inv_area;
+		C[i] = ((y[k] - y[j]) * x[j] - (x[k] - x[j]) * y[j]) * inv_area;
+		QA += A[i] * q[i];
+		QB += B[i] * q[i];
+		QC += C[i] * q[i];
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 e_step[3] = { _mm_set1_ps(4.0f * A[0]), _mm_set1_ps(4.0f * A[1]), _mm_set1_ps(4.0f * A[2]) };
+	const __m128 q_step = _mm_set1_ps(4.0f * QA);
+	for (int py = min_y; py <= max_y; py++) {
+		const float fy = py + 0.5f;
+		const __m128 fx = _mm_add_ps(_mm_set1_ps((float)min_x), lane);
+		__m128 e[3];
+		for (int i = 0; i < 3; i++) {
+			e[i] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[i]), fx), _mm_set1_ps(B[i] * fy + C[i]));
+		}
+		__m128 qz = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(QA), fx), _mm_set1_ps(QB * fy + QC));
+		float* row = &depth[py * size];
+		for (int px = min_x; px <= max_x; px += 4) {
+			const __m128 inside = _mm_and_ps(_mm_cmpge_ps(e[0], zero),
+				_mm_and_ps(_mm_cmpge_ps(e[1], zero), _mm_cmpge_ps(e[2], zero)));
+			_mm_storeu_ps(row + px, _mm_max_ps(_mm_loadu_ps(row + px), _mm_and_ps(inside, qz)));
+			e[0] = _mm_add_ps(e[0], e_step[0]);
+			e[1] = _mm_add_ps(e[1], e_step[1]);
+			e[2] = _mm_add_ps(e[2], e_step[2]);
+			qz = _mm_add_ps(qz, q_step);
+		}
+	}
+}
+
+float SHADOW_MAP::lookup(V3& p) {
+	V3 l = ppc->Project(p);
+	if (l[Dim::Z] <= 0.0f) return 1.0f;
+	const int cx = (int)floor(l[Dim::X]);
+	const int cy = (int)floor(l[Dim::Y]);
+	if (cx < 0 || cy < 0 || cx >= size || cy >= size) return 1.0f;
+	// lit when nothing in the map is clearly nearer the light.
+	const float limit = (1.0f + SHADOW_BIAS) / l[Dim::Z];
+	int lit = 0;
+	for (int dy = -SHADOW_PCF; dy <= SHADOW_PCF; dy++) {
+		const int ty = max(0, min(cy + dy, size - 1));
+		for (int dx = -SHADOW_PCF; dx <= SHADOW_PCF; dx++) {
+			const int tx = max(0, min(cx + dx, size - 1));
+			lit += depth[ty * size + tx] <= limit;
+		}
+	}
+	return lit / (float)((2 * SHADOW_PCF + 1) * (2 * SHADOW_PCF + 1));
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "Simplify.hpp"
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "Parallel.hpp"
+
+void QUADRIC::add_plane(double a, double b, double c, double d, double w) {
+	q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+	q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+	q[7] += w * c * c; q[8] += w * c * d;
+	q[9] += w * d * d;
+	weight += w;
+}
+
+void QUADRIC::operator+=(const QUADRIC& o) {
+	for (int i = 0; i < 10; i++) q[i] += o.q[i];
+	weight += o.weight;
+}
+
+double QUADRIC::error(V3& v) const {
+	const double x = v[0], y = v[1], z = v[2];
+	return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+		+ q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+		+ q[7] * z * z + 2.0 * q[8] * z
+		+ q[9];
+}
+
+double QUADRIC::distance(V3& v) const {
+	return weight > 0.0 ? sqrt(max(error(v), 0.0) / weight) : 0.0;
+}
+
+// candidate collapse of vertex from into vertex to.
+class COLLAPSE {
+public:
+	double cost;
+	int from, to;
+	U32 stamp_from, stamp_to; // vertex versions when queued, stale if changed
+
+	bool operator<(const COLLAPSE& o) const { return cost > o.cost; } // min heap
+};
+
+static inline void triNormal(V3* verts, const U32* t, double n[3]) {
+	V3& a = verts[t[0]];
+	V3& b = verts[t[1]];
+	V3& c = verts[t[2]];
+	const double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	const double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+float simplify_mesh(MESH& src, int target, MESH& out) {
+	const int nv = src.num_verts, nt = src.num_tris;
+	V3* verts = src.verts;
+	vector<U32> tris(src.tris, src.tris + nt * 3);
+	vector<QUADRIC> quadrics(nv);
+	vector<vector<int>> vert_tris(nv);
+	unordered_map<unsigned long long, int> edges; // (min, max) -> triangles sharing it
+
+	// plane of every face on its corners, unweighted so errors are distances^2.
+	for (int t = 0; t < nt; t++) {
+		const U32* idx = &tris[t * 3];
+		double n[3];
+		triNormal(verts, idx, n);
+		const double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		for (int i = 0; i < 3; i++) vert_tris[idx[i]].push_back(t);
+		for (int i = 0; i < 3; i++) {
+			const U32 a = min(idx[i], idx[(i + 1) % 3]), b = max(idx[i], idx[(i + 1) % 3]);
+			edges[((unsigned long long)a << 32) | b]++;
+		}
+		if (len == 0.0) continue;
+		const double a = n[0] / len, b = n[1] / len, c = n[2] / len;
+		const double d = -(a * verts[idx[0]][0] + b * verts[idx[0]][1] + c * verts[idx[0]][2]);
+		for (int i = 0; i < 3; i++) quadrics[idx[i]].add_plane(a, b, c, d, 1.0);
+	}
+	// open borders: a plane through the edge, perpendicular to its face.
+	for (int t = 0; t < nt; t++) {
+		const U32* idx = &tris[t * 3];
+		double n[3];
+		triNormal(verts, idx, n);
+		for (int i = 0; i < 3; i++) {
+			const U32 a = idx[i], b = idx[(i + 1) % 3];
+			if (edges[((unsigned long long)min(a, b) << 32) | max(a, b)] != 1) continue;
+			const double e[3] = { verts[b][0] - verts[a][0], verts[b][1] - verts[a][1], verts[b][2] - verts[a][2] };
+			double p[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+			const double len = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+			if (len == 0.0) continue;
+			for (int d = 0; d < 3; d++) p[d] /= len;
+			const double d = -(p[0] * verts[a][0] + p[1] * verts[a][1] + p[2] * verts[a][2]);
+			quadrics[a].add_plane(p[0], p[1], p[2], d, LOD_BOUNDARY_WEIGHT);
+			quadrics[b].add_plane(p[0], p[1], p[2], d, LOD_BOUNDARY_WEIGHT);
+		}
+	}
+
+	// half edge collapses: the survivor keeps its position and attributes.
+	vector<U32> stamp(nv, 0);
+	vector<bool> removed(nv, false), dead(nt, false);
+	priority_queue<COLLAPSE> heap;
+	auto push = [&](int a, int b) {
+		QUADRIC q = quadrics[a];
+		q += quadrics[b];
+		const double to_b = q.error(verts[b]), to_a = q.error(verts[a]);
+		if (to_b <= to_a) heap.push(COLLAPSE{ max(to_b, 0.0), a, b, stamp[a], stamp[b] });
+		else heap.push(COLLAPSE{ max(to_a, 0.0), b, a, stamp[b], stamp[a] });
+	};
+	for (auto& e : edges) push((int)(e.first >> 32), (int)(e.first & 0xFFFFFFFF));
+
+	int live = nt;
+	double max_distance = 0.0;
+	while (live > target && !heap.empty()) {
+		COLLAPSE c = heap.top();
+		heap.pop();
+		if (removed[c.from] || removed[c.to] || stamp[c.from] != c.stamp_from || stamp[c.to] != c.stamp_to) continue;
+
+		// reject collapses that flip a face around from.
+		bool flips = false;
+		for (int t : vert_tris[c.from]) {
+			if (dead[t]) continue;
+			U32* idx = &tris[t * 3];
+			if (idx[0] == (U32)c.to || idx[1] == (U32)c.to || idx[2] == (U32)c.to) continue;
+			double before[3], after[3];
+			triNormal(verts, idx, before);
+			U32 moved[3] = { idx[0], idx[1], idx[2] };
+			for (int i = 0; i < 3; i++) if (moved[i] == (U32)c.from) moved[i] = c.to;
+			triNormal(verts, moved, after);
+			if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0) {
+				flips = true;
+				break;
+			}
+		}
+		if (flips) continue;
+
+		for (int t : vert_tris[c.from]) {
+			if (dead[t]) continue;
+			U32* idx = &tris[t * 3];
+			if (idx[0] == (U32)c.to || idx[1] == (U32)c.to || idx[2] == (U32)c.to) {
+				dead[t] = true;
+				live--;
+				continue;
+			}
+			for (int i = 0; i < 3; i++) if (idx[i] == (U32)c.from) idx[i] = c.to;
+			vert_tris[c.to].push_back(t);
+		}
+		removed[c.from] = true;
+		quadrics[c.to] += quadrics[c.from];
+		stamp[c.to]++;
+		max_distance = max(max_distance, quadrics[c.to].distance(verts[c.to]));
+		for (int t : vert_tris[c.to]) {
+			if (dead[t]) continue;
+			for (int i = 0; i < 3; i++) {
+				const int w = tris[t * 3 + i];
+				if (w != c.to) push(c.to, w);
+			}
+		}
+	}
+
+	// compact the survivors.
+	vector<int> remap(nv, -1);
+	int num_verts = 0;
+	for (int t = 0; t < nt; t++) {
+		if (dead[t]) continue;
+		for (int i = 0; i < 3; i++) {
+			if (remap[tris[t * 3 + i]] < 0) remap[tris[t * 3 + i]] = num_verts++;
+		}
+	}
+	out.num_verts = num_verts;
+	out.num_tris = live;
+	out.verts = new V3[num_verts];
+	if (src.colors) out.colors = new V3[num_verts];
+	if (src.normals) out.normals = new V3[num_verts];
+	if (src.tcs) out.tcs = new float[num_verts * 2];
+	for (int v = 0; v < nv; v++) {
+		const int r = remap[v];
+		if (r < 0) continue;
+		out.verts[r] = verts[v];
+		if (src.colors) out.colors[r] = src.colors[v];
+		if (src.normals) out.normals[r] = src.normals[v];
+		if (src.tcs) {
+			out.tcs[r * 2] = src.tcs[v * 2];
+			out.tcs[r * 2 + 1] = src.tcs[v * 2 + 1];
+		}
+	}
+	out.tris = new U32[live * 3];
+	int k = 0;
+	for (int t = 0; t < nt; t++) {
+		if (dead[t]) continue;
+		for (int i = 0; i < 3; i++) out.tris[k * 3 + i] = remap[tris[t * 3 + i]];
+		k++;
+	}
+	out.color = src.color;
+	return (float)max_distance;
+}
+
+// levels are independent simplifications of this mesh (no error pile up), so
+// they run on separate threads.
+void MESH::BuildLods() {
+	if (!num_tris || packed) return;
+	auto t1 = chrono::high_resolution_clock::now();
+	for (MESH* lod : lods) delete lod;
+	lods.clear();
+	lod_error.clear();
+
+	// bounding sphere for selection
+	V3 lo = verts[0], hi = verts[0];
+	for (int i = 1; i < num_verts; i++) {
+		for (int d = 0; d < 3; d++) {
+			lo[d] = min(lo[d], verts[i][d]);
+			hi[d] = max(hi[d], verts[i][d]);
+		}
+	}
+	for (int d = 0; d < 3; d++) bound_center[d] = (lo[d] + hi[d]) * 0.5f;
+	V3 half = V3(hi[0] - bound_center[0], hi[1] - bound_center[1], hi[2] - bound_center[2]);
+	bound_radius = half.length();
+
+	vector<int> targets;
+	for (int t = num_tris / LOD_RATIO; t >= LOD_MIN_TRIS && (int)targets.size() < LOD_MAX_LEVELS; t /= LOD_RATIO) {
+		targets.push_back(t);
+	}
+	const int levels = (int)targets.size();
+	lods.resize(levels);
+	lod_error.resize(levels);
+	parallel_for(0, levels, [this, &targets](int lo, int hi) {
+		for (int l = lo; l < hi; l++) {
+			lods[l] = new MESH();
+			lod_error[l] = simplify_mesh(*this, targets[l], *lods[l]);
+			if (MESH_OPTIMIZE) lods[l]->Optimize();
+			lods[l]->base = this;
+			lods[l]->texture = texture;
+			lods[l]->bound_center = bound_center;
+			lods[l]->bound_radius = bound_radius;
+		}
+	});
+	auto t2 = chrono::high_resolution_clock::now();
+	cout << "lods (" << chrono::duration<double, milli>(t2 - t1).count() << " ms):";
+	for (int l = 0; l < levels; l++) {
+		cout << " " << lods[l]->num_tris << " tris / error " << lod_error[l] << ",";
+	}
+	cout << "\n";
+}
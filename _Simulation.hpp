@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Simulation.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <chrono>
+
+#include "scene.h"
+
+bool INPUT_LOG::save(const char* fname) {
+	ofstream out(fname, ios::binary);
+	if (!out) {
+		cout << fname << " could not be written" << endl;
+		return false;
+	}
+	const U32 header[4] = { INPUT_LOG_MAGIC, INPUT_LOG_VERSION, ticks, (U32)keys.size() };
+	out.write((char*)header, sizeof(header));
+	out.write((char*)&seed, sizeof(seed));
+	out.write((char*)&hash, sizeof(hash));
+	out.write((char*)key_ticks.data(), keys.size() * sizeof(unsigned int));
+	out.write((char*)keys.data(), keys.size() * sizeof(int));
+	return true;
+}
+
+bool INPUT_LOG::load(const char* fname) {
+	ifstream in(fname, ios::binary);
+	U32 header[4];
+	if (!in.read((char*)header, sizeof(header)) || header[0] != INPUT_LOG_MAGIC || header[1] != INPUT_LOG_VERSION) {
+		cout << fname << " is not an input log" << endl;
+		return false;
+	}
+	ticks = header[2];
+	key_ticks.resize(header[3]);
+	keys.resize(header[3]);
+	in.read((char*)&seed, sizeof(seed));
+	in.read((char*)&hash, sizeof(hash));
+	in.read((char*)key_ticks.data(), keys.size() * sizeof(unsigned int));
+	in.read((char*)keys.data(), keys.size() * sizeof(int));
+	if (!in) {
+		cout << fname << " is truncated" << endl;
+		return false;
+	}
+	return true;
+}
+
+void SIMULATION::start(unsigned long long seed) {
+	scene->reset_simulation(seed);
+	tick = 0;
+	alpha = 0.0f;
+	accumulator = 0.0;
+	next_key = 0;
+	log = INPUT_LOG();
+	log.seed = seed;
+}
+
+int SIMULATION::advance(double seconds, FrameBuffer* fb) {
+	const double dt = 1.0 / SIM_HZ;
+	accumulator += seconds;
+	int ran = 0;
+	for (; accumulator >= dt && ran < SIM_MAX_TICKS; ran++) {
+		keys.clear();
+		// live keys are still drained (and timed) while a replay drives the scene.
+		fb->consumeInput(keys);
+		if (replaying) {
+			keys.clear();
+			replay_keys(log);
+		}
+		step();
+		accumulator -= dt;
+		if (replaying && tick >= log.ticks) {
+			replaying = false;
+			cout << "replay finished at tick " << tick << ", state "
+				<< (scene->state_hash() == log.hash ? "matches" : "differs from") << " the recording\n";
+		}
+	}
+	// too far behind: drop the backlog instead of spiralling.
+	if (ran == SIM_MAX_TICKS && accumulator >= dt) accumulator = 0.0;
+	alpha = (float)(accumulator / dt);
+	return ran;
+}
+
+void SIMULATION::replay_keys(INPUT_LOG& from) {
+	while (next_key < from.keys.size() && from.key_ticks[next_key] <= tick) {
+		keys.push_back(from.keys[next_key++]);
+	}
+}
+
+void SIMULATION::step() {
+	if (recording) {
+		for (int key : keys) {
+			log.key_ticks.push_back(tick);
+			log.keys.push_back(key);
+		}
+	}
+	scene->step(keys);
+	tick++;
+	if (recording && tick % SIM_HZ == 0) {
+		log.ticks = tick;
+		log.hash = scene->state_hash();
+		log.save(INPUT_LOG_FILE);
+	}
+}
+
+void SIMULATION::replay_headless(const char* fname) {
+	INPUT_LOG replay;
+	if (!replay.load(fname)) return;
+	const bool was_recording = recording;
+	recording = false;
+	replaying = false;
+	start(replay.seed);
+
+	auto t1 = chrono::high_resolution_clock::now();
+	while (tick < replay.ticks) {
+		keys.clear();
+		replay_keys(replay);
+		step();
+	}
+	auto t2 = chrono::high_resolution_clock::now();
+	const double ms = chrono::duration<double, milli>(t2 - t1).count();
+	const unsigned long long hash = scene->state_hash();
+	cout << "replayed " << replay.ticks << " ticks (" << replay.keys.size() << " keys) in " << ms << " ms, "
+		<< (ms > 0.0 ? replay.ticks / ms * 1000.0 : 0.0) << " ticks/s, state "
+		<< (hash == replay.hash ? "matches" : "differs from") << " the recording\n";
+
+	start(SIM_SEED);
+	recording = was_recording;
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include "Streaming.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "MeshOptimize.hpp"
+
+// file layout: magic, version, cluster count, reserved, table, cluster data.
+static const U32 CHUNK_MAGIC = 0x4B48434D; // "MCHK"
+static const U32 CHUNK_VERSION = 1;
+static const size_t CHUNK_HEADER = 4 * sizeof(U32);
+
+bool write_chunked_mesh(MESH& mesh, const char* fname) {
+	vector<int> order;
+	spatial_order(mesh, order);
+	const int num_clusters = (mesh.num_tris + STREAM_CLUSTER_TRIS - 1) / STREAM_CLUSTER_TRIS;
+	ofstream out(fname, ios::binary);
+	if (!out) {
+		cout << fname << " could not be written" << endl;
+		return false;
+	}
+	U32 header[4] = { CHUNK_MAGIC, CHUNK_VERSION, (U32)num_clusters, 0 };
+	out.write((char*)header, sizeof(header));
+	vector<CLUSTER_INFO> table(num_clusters);
+	out.write((char*)table.data(), num_clusters * sizeof(CLUSTER_INFO)); // patched below
+	unsigned long long offset = CHUNK_HEADER + num_clusters * sizeof(CLUSTER_INFO);
+
+	vector<int> local(mesh.num_verts, -1);
+	vector<V3> verts;
+	vector<U32> tris;
+	for (int c = 0; c < num_clusters; c++) {
+		const int first = c * STREAM_CLUSTER_TRIS;
+		const int last = min(first + STREAM_CLUSTER_TRIS, mesh.num_tris);
+		verts.clear();
+		tris.clear();
+		for (int t = first; t < last; t++) {
+			for (int i = 0; i < 3; i++) {
+				const U32 v = mesh.index(order[t] * 3 + i);
+				if (local[v] < 0) {
+					local[v] = (int)verts.size();
+					verts.push_back(mesh.vertex(v));
+				}
+				tris.push_back((U32)local[v]);
+			}
+		}
+		CLUSTER_INFO& info = table[c];
+		for (int d = 0; d < 3; d++) {
+			info.lo[d] = FLT_MAX;
+			info.hi[d] = -FLT_MAX;
+		}
+		for (V3& v : verts) {
+			for (int d = 0; d < 3; d++) {
+				info.lo[d] = min(info.lo[d], v[d]);
+				info.hi[d] = max(info.hi[d], v[d]);
+			}
+		}
+		info.offset = offset;
+		info.num_verts = (U32)verts.size();
+		info.num_tris = (U32)(tris.size() / 3);
+		out.write((char*)verts.data(), verts.size() * sizeof(V3));
+		out.write((char*)tris.data(), tris.size() * sizeof(U32));
+		offset += verts.size() * sizeof(V3) + tris.size() * sizeof(U32);
+		// reset only what this cluster touched.
+		for (int t = first; t < last; t++) {
+			for (int i = 0; i < 3; i++) local[mesh.index(order[t] * 3 + i)] = -1;
+		}
+	}
+	out.seekp(CHUNK_HEADER);
+	out.write((char*)table.data(), num_clusters * sizeof(CLUSTER_INFO));
+	if (!out) {
+		cout << fname << " could not be written" << endl;
+		return false;
+	}
+	cout << "chunked " << mesh.num_tris << " triangles into " << num_clusters << " clusters (" << offset / (1 << 20) << " MB): " << fname << endl;
+	return true;
+}
+
+bool swap_drawn(vector<MESH*>& meshes, vector<MESH*>& drawn, vector<MESH*>& next) {
+	if (next == drawn) return false;
+	vector<MESH*> old = drawn;
+	sort(old.begin(), old.end());
+	meshes.erase(remove_if(meshes.begin(), meshes.end(), [&old](MESH* mesh) {
+		return binary_search(old.begin(), old.end(), mesh);
+	}), meshes.end());
+	meshes.insert(meshes.end(), next.begin(), next.end());
+	drawn.swap(next);
+	return true;
+}
+
+static void unmap_chunks(const unsigned char* data, size_t size, void* file_handle, void* map_handle) {
+#ifdef _WIN32
+	if (data) UnmapViewOfFile(data);
+	if (map_handle) CloseHandle(map_handle);
+	if (file_handle) CloseHandle(file_handle);
+#else
+	(void)file_handle;
+	(void)map_handle;
+	if (data) munmap((void*)data, size);
+#endif
+}
+
+STREAMED_MESH::STREAMED_MESH(const char* fname, size_t budget_bytes) : budget(budget_bytes) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) {
+		cout << fname << " could not be opened" << endl;
+		return;
+	}
+	LARGE_INTEGER length;
+	GetFileSizeEx(file, &length);
+	size = (size_t)length.QuadPart;
+	HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+	file_handle = file;
+	map_handle = mapping;
+	data = mapping ? (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+#else
+	int file = open(fname, O_RDONLY);
+	if (file < 0) {
+		cout << fname << " could not be opened" << endl;
+		return;
+	}
+	struct stat info;
+	fstat(file, &info);
+	size = (size_t)info.st_size;
+	void* view = size ? mmap(0, size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	close(file);
+	data = view == MAP_FAILED ? 0 : (const unsigned char*)view;
+#endif
+	const U32* header = (const U32*)data;
+	if (!data || size < CHUNK_HEADER || header[0] != CHUNK_MAGIC || header[1] != CHUNK_VERSION
+		|| size < CHUNK_HEADER + header[2] * sizeof(CLUSTER_INFO)) {
+		cout << fname << " is not a chunked mesh" << endl;
+		unmap_chunks(data, size, file_handle, map_handle);
+		data = 0;
+		file_handle = map_handle = 0;
+		return;
+	}
+	clusters.resize(header[2]);
+	memcpy(clusters.data(), data + CHUNK_HEADER, clusters.size() * sizeof(CLUSTER_INFO));
+	// load copies straight out of the mapping, every range has to be inside it
+	// (a conversion that was cut short leaves a file shorter than its table).
+	for (CLUSTER_INFO& info : clusters) {
+		const unsigned long long bytes = (unsigned long long)info.num_verts * sizeof(V3) + (unsigned long long)info.num_tris * 3 * sizeof(U32);
+		if (info.offset > size || bytes > size - info.offset) {
+			cout << fname << " is truncated, delete it to convert STREAM_SOURCE again" << endl;
+			clusters.clear();
+			unmap_chunks(data, size, file_handle, map_handle);
+			data = 0;
+			file_handle = map_handle = 0;
+			return;
+		}
+	}
+	resident.assign(clusters.size(), 0);
+	last_used.assign(clusters.size(), 0);
+	loader = thread([this] { loader_main(); });
+}
+
+STREAMED_MESH::~STREAMED_MESH() {
+	{
+		lock_guard<mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_one();
+	if (loader.joinable()) loader.join();
+	for (MESH* mesh : resident) delete mesh;
+	unmap_chunks(data, size, file_handle, map_handle);
+}
+
+// copy a cluster out of the mapping; the first touch pages it in.
+MESH* STREAMED_MESH::load(int c) {
+	CLUSTER_INFO& info = clusters[c];
+	MESH* mesh = new MESH();
+	mesh->num_verts = info.num_verts;
+	mesh->num_tris = info.num_tris;
+	mesh->verts = new V3[info.num_verts];
+	mesh->tris = new U32[info.num_tris * 3];
+	memcpy(mesh->verts, data + info.offset, info.num_verts * sizeof(V3));
+	memcpy(mesh->tris, data + info.offset + info.num_verts * sizeof(V3), info.num_tris * 3 * sizeof(U32));
+	mesh->color = color;
+	return mesh;
+}
+
+bool STREAMED_MESH::install(int c, MESH* mesh) {
+	lock_guard<mutex> guard(lock);
+	if (resident[c] || resident_bytes + cluster_bytes(c) > budget) {
+		delete mesh;
+		return false;
+	}
+	resident[c] = mesh;
+	resident_bytes += cluster_bytes(c);
+	last_used[c] = frame;
+	return true;
+}
+
+void STREAMED_MESH::visible_clusters(PPC* ppc, vector<int>& out) {
+	out.clear();
+	float planes[20];
+	ppc->GetFrustumPlanes(planes);
+	V3 vd = ppc->GetVD();
+	const float f = ppc->c * vd;
+	const float a_len = ppc->a.length();
+	for (int c = 0; c < (int)clusters.size(); c++) {
+		CLUSTER_INFO& info = clusters[c];
+		bool inside = true;
+		for (int p = 0; p < 5 && inside; p++) {
+			const float* plane = &planes[p * 4];
+			float d = plane[3];
+			for (int k = 0; k < 3; k++) d += plane[k] * (plane[k] > 0.0f ? info.hi[k] : info.lo[k]);
+			inside = d >= 0.0f;
+		}
+		if (!inside) continue;
+		// bounding sphere size on screen, a pixel is |a| * depth / f wide.
+		V3 center;
+		float radius = 0.0f;
+		for (int k = 0; k < 3; k++) {
+			center[k] = 0.5f * (info.lo[k] + info.hi[k]) - ppc->C[k];
+			radius += (info.hi[k] - info.lo[k]) * (info.hi[k] - info.lo[k]);
+		}
+		radius = 0.5f * sqrtf(radius);
+		const float depth = center * vd - radius;
+		if (depth > 0.0f && radius * f < STREAM_MIN_PIXELS * depth * a_len) continue;
+		out.push_back(c);
+	}
+}
+
+size_t STREAMED_MESH::resident_size() {
+	lock_guard<mutex> guard(lock);
+	return resident_bytes;
+}
+
+bool STREAMED_MESH::update(PPC* ppc, vector<MESH*>& meshes) {
+	if (!data) return false;
+	{
+		lock_guard<mutex> guard(lock);
+		frame++;
+	}
+	loads = evictions = prefetched = skipped = 0;
+	vector<int> want;
+	visible_clusters(ppc, want);
+	visible = (int)want.size();
+
+	// nearest first, so a full budget skips the farthest clusters.
+	V3 vd = ppc->GetVD();
+	vector<pair<float, int>> by_depth;
+	by_depth.reserve(want.size());
+	for (int c : want) {
+		V3 center;
+		for (int k = 0; k < 3; k++) center[k] = 0.5f * (clusters[c].lo[k] + clusters[c].hi[k]) - ppc->C[k];
+		by_depth.push_back(make_pair(center * vd, c));
+	}
+	sort(by_depth.begin(), by_depth.end());
+
+	// evict least recently used clusters that aren't visible until the misses fit.
+	{
+		lock_guard<mutex> guard(lock);
+		size_t needed = 0;
+		for (int c : want) {
+			last_used[c] = frame;
+			if (!resident[c]) needed += cluster_bytes(c);
+		}
+		if (resident_bytes + needed > budget) {
+			vector<int> lru;
+			for (int c = 0; c < (int)clusters.size(); c++) {
+				if (resident[c] && last_used[c] != frame) lru.push_back(c);
+			}
+			sort(lru.begin(), lru.end(), [this](int a, int b) { return last_used[a] < last_used[b]; });
+			for (int i = 0; i < (int)lru.size() && resident_bytes + needed > budget; i++) {
+				const int c = lru[i];
+				resident_bytes -= cluster_bytes(c);
+				delete resident[c];
+				resident[c] = 0;
+				evictions++;
+			}
+		}
+	}
+
+	// visible misses are needed this frame, load the ones that fit now.
+	vector<MESH*> next;
+	next.reserve(want.size());
+	for (auto& entry : by_depth) {
+		const int c = entry.second;
+		MESH* mesh;
+		bool fits;
+		{
+			lock_guard<mutex> guard(lock);
+			mesh = resident[c];
+			fits = resident_bytes + cluster_bytes(c) <= budget;
+		}
+		if (!mesh && fits && install(c, load(c))) {
+			loads++;
+			lock_guard<mutex> guard(lock);
+			mesh = resident[c];
+		}
+		if (!mesh) {
+			skipped++;
+			continue;
+		}
+		next.push_back(mesh);
+	}
+
+	// a load can reuse an evicted cluster's address, loads always count as a change.
+	const bool changed = swap_drawn(meshes, drawn, next) || loads > 0;
+
+	// prefetch what the camera sees STREAM_PREFETCH_FRAMES frames ahead at
+	// its current velocity. stale requests are dropped.
+	if (frame > 1) {
+		PPC ahead = *ppc;
+		const float k = (float)STREAM_PREFETCH_FRAMES;
+		bool moving = false;
+		for (int d = 0; d < 3; d++) {
+			ahead.C[d] += (ppc->C[d] - last_C[d]) * k;
+			ahead.a[d] += (ppc->a[d] - last_a[d]) * k;
+			ahead.b[d] += (ppc->b[d] - last_b[d]) * k;
+			ahead.c[d] += (ppc->c[d] - last_c[d]) * k;
+			moving = moving || ahead.C[d] != ppc->C[d] || ahead.c[d] != ppc->c[d];
+		}
+		if (moving) {
+			vector<int> future;
+			visible_clusters(&ahead, future);
+			lock_guard<mutex> guard(lock);
+			queue.clear();
+			for (int c : future) {
+				if (resident[c]) continue;
+				queue.push_back(c);
+				prefetched++;
+			}
+		}
+		if (prefetched) wake.notify_one();
+	}
+	last_C = ppc->C;
+	last_a = ppc->a;
+	last_b = ppc->b;
+	last_c = ppc->c;
+	return changed;
+}
+
+void STREAMED_MESH::loader_main() {
+	while (true) {
+		int c;
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [this] { return quit || !queue.empty(); });
+			if (quit) return;
+			c = queue.front();
+			queue.pop_front();
+			// prefetches never push the cache over budget.
+			if (resident[c] || resident_bytes + cluster_bytes(c) > budget) continue;
+		}
+		install(c, load(c));
+	}
+}
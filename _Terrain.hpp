@@ -0,0 +1,262 @@
+#pragma once
+
+#include "Terrain.hpp"
+#include "Streaming.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+TERRAIN::TERRAIN(MESH& grid, V3 center, float size) {
+	V3* v = grid.verts;
+	if (!v || grid.num_verts < 4) {
+		cout << "terrain: no grid vertices" << endl;
+		return;
+	}
+	int n = 1;
+	while (n < grid.num_verts && v[n][1] == v[0][1]) n++;
+	const int c = n, r = grid.num_verts / n;
+	bool ok = c >= 2 && r >= 2 && c * r == grid.num_verts;
+	const float dx = ok ? v[1][0] - v[0][0] : 0.0f;
+	const float dy = ok ? v[c][1] - v[0][1] : 0.0f;
+	ok = ok && dx != 0.0f && dy != 0.0f;
+	float zlo = v[0][2], zhi = v[0][2];
+	for (int k = 0; ok && k < grid.num_verts; k++) {
+		ok = fabs(v[k][0] - (v[0][0] + dx * (k % c))) <= 0.01f * fabs(dx)
+			&& fabs(v[k][1] - (v[0][1] + dy * (k / c))) <= 0.01f * fabs(dy);
+		zlo = min(zlo, v[k][2]);
+		zhi = max(zhi, v[k][2]);
+	}
+	if (!ok) {
+		cout << "terrain: vertices are not a row major grid" << endl;
+		return;
+	}
+	cols = c;
+	rows = r;
+	const float extent = max3(fabs(dx) * (cols - 1), fabs(dy) * (rows - 1), zhi - zlo);
+	const float scale = size / extent;
+	step_x = dx * scale;
+	step_z = dy * scale;
+	origin = V3(center[0] - 0.5f * step_x * (cols - 1), 0.0f, center[2] + 0.5f * step_z * (rows - 1));
+	heights.resize(grid.num_verts);
+	for (int k = 0; k < grid.num_verts; k++) {
+		heights[k] = center[1] + (v[k][2] - 0.5f * (zlo + zhi)) * scale;
+	}
+	if (grid.colors) colors.assign(grid.colors, grid.colors + grid.num_verts);
+
+	const int quads = max(cols, rows) - 1;
+	levels = 1;
+	while ((TERRAIN_CHUNK << (levels - 1)) < quads) levels++;
+	// height range per chunk, level 0 from samples, the rest from children.
+	node_lo.resize(levels);
+	node_hi.resize(levels);
+	for (int level = 0; level < levels; level++) {
+		const int m = chunks(level);
+		node_lo[level].assign(m * m, FLT_MAX);
+		node_hi[level].assign(m * m, -FLT_MAX);
+	}
+	for (int j = 0; j < rows; j++) {
+		for (int i = 0; i < cols; i++) {
+			// samples on a chunk border belong to both chunks.
+			const int x0 = i && i % TERRAIN_CHUNK == 0 ? i / TERRAIN_CHUNK - 1 : i / TERRAIN_CHUNK;
+			const int z0 = j && j % TERRAIN_CHUNK == 0 ? j / TERRAIN_CHUNK - 1 : j / TERRAIN_CHUNK;
+			const int x1 = min(i / TERRAIN_CHUNK, chunks(0) - 1), z1 = min(j / TERRAIN_CHUNK, chunks(0) - 1);
+			const float h = heights[j * cols + i];
+			for (int z = z0; z <= z1; z++) {
+				for (int x = x0; x <= x1; x++) {
+					node_lo[0][z * chunks(0) + x] = min(node_lo[0][z * chunks(0) + x], h);
+					node_hi[0][z * chunks(0) + x] = max(node_hi[0][z * chunks(0) + x], h);
+				}
+			}
+		}
+	}
+	for (int level = 1; level < levels; level++) {
+		const int m = chunks(level);
+		for (int z = 0; z < m; z++) {
+			for (int x = 0; x < m; x++) {
+				for (int k = 0; k < 4; k++) {
+					const int child = (2 * z + (k >> 1)) * chunks(level - 1) + 2 * x + (k & 1);
+					node_lo[level][z * m + x] = min(node_lo[level][z * m + x], node_lo[level - 1][child]);
+					node_hi[level][z * m + x] = max(node_hi[level][z * m + x], node_hi[level - 1][child]);
+				}
+			}
+		}
+	}
+	leaf_level.assign(chunks(0) * chunks(0), 0);
+	cout << "terrain: " << cols << " x " << rows << " samples, " << levels << " levels of " << TERRAIN_CHUNK << " x " << TERRAIN_CHUNK << " chunks" << endl;
+}
+
+TERRAIN::~TERRAIN() {
+	for (auto& entry : cache) delete entry.second.mesh;
+}
+
+float TERRAIN::height(int i, int j) {
+	i = min(max(i, 0), cols - 1);
+	j = min(max(j, 0), rows - 1);
+	return heights[j * cols + i];
+}
+
+void TERRAIN::bounds(int level, int x, int z, float* lo, float* hi) {
+	const int span = TERRAIN_CHUNK << level;
+	const float x0 = origin[0] + step_x * (x * span), x1 = origin[0] + step_x * min((x + 1) * span, cols - 1);
+	const float z0 = origin[2] - step_z * (z * span), z1 = origin[2] - step_z * min((z + 1) * span, rows - 1);
+	lo[0] = min(x0, x1);
+	hi[0] = max(x0, x1);
+	lo[1] = node_lo[level][z * chunks(level) + x];
+	hi[1] = node_hi[level][z * chunks(level) + x];
+	lo[2] = min(z0, z1);
+	hi[2] = max(z0, z1);
+}
+
+// split by distance from the camera to the chunk box. every chunk is
+// selected (visible or not) so neighbour levels are known for stitching.
+void TERRAIN::select(PPC* ppc, int level, int x, int z, vector<int>& out) {
+	if (node_lo[level][z * chunks(level) + x] > node_hi[level][z * chunks(level) + x]) return; // past the samples
+	float lo[3], hi[3];
+	bounds(level, x, z, lo, hi);
+	float d2 = 0.0f;
+	for (int k = 0; k < 3; k++) {
+		const float e = max(max(lo[k] - ppc->C[k], ppc->C[k] - hi[k]), 0.0f);
+		d2 += e * e;
+	}
+	const float size = (TERRAIN_CHUNK << level) * max(fabs(step_x), fabs(step_z));
+	if (level > 0 && d2 < TERRAIN_LOD_DISTANCE * TERRAIN_LOD_DISTANCE * size * size) {
+		for (int k = 0; k < 4; k++) select(ppc, level - 1, 2 * x + (k & 1), 2 * z + (k >> 1), out);
+		return;
+	}
+	out.push_back((level << 24) | (z << 12) | x);
+}
+
+U32 TERRAIN::stitching(int level, int x, int z) {
+	const int n = 1 << level, m = chunks(0);
+	const int cells[4][2] = { { x * n - 1, z * n }, { x * n + n, z * n }, { x * n, z * n - 1 }, { x * n, z * n + n } };
+	U32 stitch = 0;
+	for (int e = 0; e < 4; e++) {
+		const int cx = cells[e][0], cz = cells[e][1];
+		if (cx < 0 || cz < 0 || cx >= m || cz >= m) continue;
+		int d = leaf_level[cz * m + cx] - level;
+		while (d > 0 && (1 << d) > TERRAIN_CHUNK) d--;
+		if (d > 0) stitch |= d << (e * 4);
+	}
+	return stitch;
+}
+
+MESH* TERRAIN::build_chunk(int level, int x, int z, U32 stitch) {
+	const int step = 1 << level, n = TERRAIN_CHUNK + 1;
+	const int i0 = x * TERRAIN_CHUNK * step, j0 = z * TERRAIN_CHUNK * step;
+	MESH* mesh = new MESH();
+	mesh->num_verts = n * n;
+	mesh->num_tris = TERRAIN_CHUNK * TERRAIN_CHUNK * 2;
+	mesh->verts = new V3[mesh->num_verts];
+	mesh->normals = new V3[mesh->num_verts];
+	if (!colors.empty()) mesh->colors = new V3[mesh->num_verts];
+	mesh->tris = new U32[mesh->num_tris * 3];
+	mesh->color = color;
+	for (int v = 0; v < n; v++) {
+		for (int u = 0; u < n; u++) {
+			const int i = min(i0 + u * step, cols - 1), j = min(j0 + v * step, rows - 1);
+			float y = heights[j * cols + i];
+			// against a coarser neighbour, vertices it lacks move onto its edge.
+			int coarse = 0, along = 0;
+			bool u_edge = false;
+			if (u == 0 || u == n - 1) {
+				coarse = (stitch >> (u ? 4 : 0)) & 15;
+				along = v;
+				u_edge = true;
+			}
+			else if (v == 0 || v == n - 1) {
+				coarse = (stitch >> (v ? 12 : 8)) & 15;
+				along = u;
+			}
+			const int k = 1 << coarse, r = along % k;
+			if (r) {
+				// in clamped samples, the neighbour's vertices clamp the same way.
+				const int limit = u_edge ? rows - 1 : cols - 1, first = u_edge ? j0 : i0;
+				const int pa = min(first + (along - r) * step, limit), pb = min(first + (along - r + k) * step, limit);
+				const int p = u_edge ? j : i;
+				const float t = pb > pa ? (float)(p - pa) / (pb - pa) : 0.0f;
+				const float ya = u_edge ? height(i, pa) : height(pa, j);
+				const float yb = u_edge ? height(i, pb) : height(pb, j);
+				y = ya * (1.0f - t) + yb * t;
+			}
+			const int idx = v * n + u;
+			mesh->verts[idx] = V3(origin[0] + step_x * i, y, origin[2] - step_z * j);
+			const float dhdx = (height(i + step, j) - height(i - step, j)) / (2.0f * step * step_x);
+			const float dhdz = -(height(i, j + step) - height(i, j - step)) / (2.0f * step * step_z);
+			V3 normal(-dhdx, 1.0f, -dhdz);
+			normal.normalize();
+			mesh->normals[idx] = normal;
+			if (mesh->colors) mesh->colors[idx] = colors[j * cols + i];
+		}
+	}
+	U32* t = mesh->tris;
+	for (int v = 0; v < TERRAIN_CHUNK; v++) {
+		for (int u = 0; u < TERRAIN_CHUNK; u++) {
+			const U32 a = v * n + u, b = a + 1, c = a + n, d = c + 1;
+			t[0] = a; t[1] = c; t[2] = b;
+			t[3] = b; t[4] = c; t[5] = d;
+			t += 6;
+		}
+	}
+	return mesh;
+}
+
+bool TERRAIN::update(PPC* ppc, vector<MESH*>& meshes) {
+	if (!levels) return false;
+	frame++;
+	generated = 0;
+	vector<int> leaves;
+	select(ppc, levels - 1, 0, 0, leaves);
+	const int m = chunks(0);
+	fill(leaf_level.begin(), leaf_level.end(), 0);
+	for (int leaf : leaves) {
+		const int level = leaf >> 24, z = (leaf >> 12) & 4095, x = leaf & 4095, n = 1 << level;
+		for (int cz = z * n; cz < min(z * n + n, m); cz++) {
+			for (int cx = x * n; cx < min(x * n + n, m); cx++) leaf_level[cz * m + cx] = level;
+		}
+	}
+
+	float planes[20];
+	ppc->GetFrustumPlanes(planes);
+	vector<MESH*> next;
+	for (int leaf : leaves) {
+		const int level = leaf >> 24, z = (leaf >> 12) & 4095, x = leaf & 4095;
+		float lo[3], hi[3];
+		bounds(level, x, z, lo, hi);
+		bool inside = true;
+		for (int p = 0; p < 5 && inside; p++) {
+			const float* plane = &planes[p * 4];
+			float d = plane[3];
+			for (int k = 0; k < 3; k++) d += plane[k] * (plane[k] > 0.0f ? hi[k] : lo[k]);
+			inside = d >= 0.0f;
+		}
+		if (!inside) continue;
+		const U32 stitch = stitching(level, x, z);
+		const unsigned long long key = ((unsigned long long)leaf << 16) | stitch;
+		auto it = cache.find(key);
+		if (it == cache.end()) {
+			it = cache.emplace(key, CHUNK_ENTRY{ build_chunk(level, x, z, stitch), frame }).first;
+			generated++;
+		}
+		it->second.used = frame;
+		next.push_back(it->second.mesh);
+	}
+	visible = (int)next.size();
+	const bool changed = swap_drawn(meshes, drawn, next);
+
+	// drop the longest unused chunk meshes over the cache size.
+	if ((int)cache.size() > TERRAIN_CACHE_CHUNKS) {
+		vector<pair<U32, unsigned long long>> unused;
+		for (auto& entry : cache) {
+			if (entry.second.used != frame) unused.push_back(make_pair(entry.second.used, entry.first));
+		}
+		sort(unused.begin(), unused.end());
+		for (int i = 0; i < (int)unused.size() && (int)cache.size() > TERRAIN_CACHE_CHUNKS; i++) {
+			auto it = cache.find(unused[i].second);
+			delete it->second.mesh;
+			cache.erase(it);
+		}
+	}
+	return changed;
+}
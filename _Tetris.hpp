@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Tetris.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// 3x3 templates, shape[i][j] covers row + i, column + j.
+static const bool tetris_shapes[TETRIS_SHAPES][3][3] = {
+	{
+		{ 0, 1, 0 },
+		{ 1, 1, 1 },
+		{ 0, 0, 1 }
+	},
+	{
+		{ 0, 1, 0 },
+		{ 1, 1, 0 },
+		{ 0, 1, 0 }
+	},
+	{
+		{ 0, 1, 0 },
+		{ 1, 1, 0 },
+		{ 0, 1, 0 }
+	}
+};
+
+TETRIS::TETRIS() {
+	for (int s = 0; s < TETRIS_SHAPES; s++) {
+		bool cells[3][3];
+		memcpy(cells, tetris_shapes[s], sizeof(cells));
+		for (int r = 0; r < 4; r++) {
+			PIECE& p = pieces[s][r];
+			p.left = 3;
+			p.right = -1;
+			p.bottom = 3;
+			for (int i = 0; i < 3; i++) {
+				p.mask[i] = 0;
+				for (int j = 0; j < 3; j++) {
+					if (!cells[i][j]) continue;
+					p.mask[i] |= 1 << j;
+					p.left = min(p.left, j);
+					p.right = max(p.right, j);
+					p.bottom = min(p.bottom, i);
+				}
+			}
+			// clockwise quarter turn: new[i][j] = old[j][2 - i].
+			bool turned[3][3];
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 3; j++) turned[i][j] = cells[j][2 - i];
+			}
+			memcpy(cells, turned, sizeof(cells));
+		}
+	}
+	reset();
+}
+
+void TETRIS::reset() {
+	memset(rows, 0, sizeof(rows));
+	shape = -1;
+	rotation = 0;
+	row = TETRIS_SPAWN_ROW;
+	col = 0;
+	score = 0;
+}
+
+bool TETRIS::fits(int s, int r, int at_row, int at_col) {
+	const PIECE& p = pieces[s][r];
+	if (at_col + p.left < 0 || at_col + p.right >= TETRIS_COLS || at_row + p.bottom < 0) return false;
+	for (int i = p.bottom; i < 3; i++) {
+		if (rows[at_row + i] & placed(p.mask[i], at_col)) return false;
+	}
+	return true;
+}
+
+bool TETRIS::spawn(int s) {
+	for (int c = 0; c < TETRIS_COLS; c++) {
+		if (!fits(s, 0, TETRIS_SPAWN_ROW, c)) continue;
+		shape = s;
+		rotation = 0;
+		row = TETRIS_SPAWN_ROW;
+		col = c;
+		return true;
+	}
+	// game over.
+	reset();
+	return false;
+}
+
+bool TETRIS::move(int dx) {
+	moves++;
+	if (shape < 0 || !fits(shape, rotation, row, col + dx)) return false;
+	col += dx;
+	return true;
+}
+
+bool TETRIS::rotate() {
+	moves++;
+	if (shape < 0 || !fits(shape, (rotation + 1) & 3, row, col)) return false;
+	rotation = (rotation + 1) & 3;
+	return true;
+}
+
+bool TETRIS::drop() {
+	moves++;
+	if (shape < 0) return false;
+	if (fits(shape, rotation, row - 1, col)) {
+		row--;
+		return true;
+	}
+	lock();
+	return false;
+}
+
+void TETRIS::lock() {
+	const PIECE& p = pieces[shape][rotation];
+	for (int i = p.bottom; i < 3; i++) rows[row + i] |= placed(p.mask[i], col);
+	shape = -1;
+	score += clear_lines();
+	high_score = max(high_score, score);
+}
+
+// full rows drop out, everything above moves down over them.
+int TETRIS::clear_lines() {
+	int kept = 0;
+	for (int r = 0; r < TETRIS_ROWS; r++) {
+		if (rows[r] != TETRIS_FULL_ROW) rows[kept++] = rows[r];
+	}
+	const int cleared = TETRIS_ROWS - kept;
+	for (; kept < TETRIS_ROWS; kept++) rows[kept] = 0;
+	return cleared;
+}
+
+void TETRIS::board(U16* out) {
+	memcpy(out, rows, TETRIS_ROWS * sizeof(U16));
+	if (shape < 0) return;
+	const PIECE& p = pieces[shape][rotation];
+	for (int i = p.bottom; i < 3 && row + i < TETRIS_ROWS; i++) out[row + i] |= placed(p.mask[i], col);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Texture.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <tiffio.h>
+#include <emmintrin.h>
+
+#include "scene.h"
+
+using namespace std;
+
+#define TEXTURE_MAX_SIZE 2048
+
+// spread the low 16 bits of x to the even bits.
+static inline U32 part1by1(U32 x) {
+	x &= 0x0000FFFF;
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+static inline U32 morton(U32 u, U32 v) {
+	return part1by1(u) | (part1by1(v) << 1);
+}
+
+// texel channels as 4 floats.
+static inline __m128 unpackTexel(U32 t) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)t), zero);
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(c, zero));
+}
+
+static inline U32 packTexel(__m128 c) {
+	__m128i i = _mm_cvtps_epi32(c);
+	i = _mm_packs_epi32(i, i);
+	return (U32)_mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+}
+
+TEXTURE::TEXTURE() {}
+
+bool TEXTURE::LoadTiff(const char* fname) {
+	TIFF* in = TIFFOpen(fname, "r");
+	if (in == NULL) {
+		cout << fname << " could not be opened" << endl;
+		return false;
+	}
+
+	int width, height;
+	TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField(in, TIFFTAG_IMAGELENGTH, &height);
+	vector<U32> rgba(width * height);
+	bool ok = TIFFReadRGBAImage(in, width, height, rgba.data(), 0) != 0;
+	TIFFClose(in);
+	if (!ok) {
+		cout << "failed to load " << fname << endl;
+		return false;
+	}
+
+	Build(rgba.data(), width, height);
+	cout << fname << ": " << size << "x" << size << " texture, " << levels << " mip levels\n";
+	return true;
+}
+
+void TEXTURE::Build(U32* rgba, int w, int h) {
+	size = 1;
+	while (size < max(w, h) && size < TEXTURE_MAX_SIZE) size <<= 1;
+	levels = 1;
+	while ((size >> (levels - 1)) > 1) levels++;
+	mips.assign(levels, vector<U32>());
+
+	// level 0: nearest resample into Morton order
+	mips[0].resize(size * size);
+	for (int v = 0; v < size; v++) {
+		const int sy = min(h - 1, (int)((v + 0.5f) * h / size));
+		for (int u = 0; u < size; u++) {
+			const int sx = min(w - 1, (int)((u + 0.5f) * w / size));
+			mips[0][morton(u, v)] = rgba[sy * w + sx];
+		}
+	}
+
+	// 2x2 box filter per level. in Morton order the four children of
+	// texel i are the contiguous texels 4i..4i+3 of the level above.
+	for (int l = 1; l < levels; l++) {
+		const int side = size >> l;
+		vector<U32>& src = mips[l - 1];
+		vector<U32>& dst = mips[l];
+		dst.resize(side * side);
+		for (int i = 0; i < side * side; i++) {
+			__m128 sum = _mm_add_ps(
+				_mm_add_ps(unpackTexel(src[4 * i]), unpackTexel(src[4 * i + 1])),
+				_mm_add_ps(unpackTexel(src[4 * i + 2]), unpackTexel(src[4 * i + 3])));
+			dst[i] = packTexel(_mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+		}
+	}
+}
+
+inline U32 TEXTURE::Texel(int level, int u, int v) {
+	const int mask = (size >> level) - 1;
+	return mips[level][morton(u & mask, v & mask)];
+}
+
+U32 TEXTURE::SampleBilinear(float u, float v, int level) {
+	// to texel space of this level, texel centers at +0.5
+	const float scale = 1.0f / (float)(1 << level);
+	u = u * scale - 0.5f;
+	v = v * scale - 0.5f;
+	const float fu = floor(u), fv = floor(v);
+	const int u0 = (int)fu, v0 = (int)fv;
+	const float a = u - fu, b = v - fv;
+
+	// all four channels blended at once.
+	__m128 c = _mm_mul_ps(unpackTexel(Texel(level, u0, v0)), _mm_set1_ps((1.0f - a) * (1.0f - b)));
+	c = _mm_add_ps(c, _mm_mul_ps(unpackTexel(Texel(level, u0 + 1, v0)), _mm_set1_ps(a * (1.0f - b))));
+	c = _mm_add_ps(c, _mm_mul_ps(unpackTexel(Texel(level, u0, v0 + 1)), _mm_set1_ps((1.0f - a) * b)));
+	c = _mm_add_ps(c, _mm_mul_ps(unpackTexel(Texel(level, u0 + 1, v0 + 1)), _mm_set1_ps(a * b)));
+	return packTexel(c);
+}
+
+U32 TEXTURE::SampleTrilinear(float u, float v, float lod) {
+	lod = max(0.0f, min(lod, (float)(levels - 1)));
+	const int l0 = (int)lod;
+	const int l1 = min(l0 + 1, levels - 1);
+	const float t = lod - l0;
+	if (t == 0.0f || l0 == l1) return SampleBilinear(u, v, l0);
+	__m128 c0 = unpackTexel(SampleBilinear(u, v, l0));
+	__m128 c1 = unpackTexel(SampleBilinear(u, v, l1));
+	return packTexel(_mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), _mm_set1_ps(t))));
+}
+
+U32 TEXTURE::Sample(float u, float v, float lod) {
+	if (TEXTURE_TRILINEAR) return SampleTrilinear(u, v, lod);
+	const int level = (int)max(0.0f, min(lod + 0.5f, (float)(levels - 1)));
+	return SampleBilinear(u, v, level);
+}
@@ -30,4 +30,63 @@ V3 PPC::GetVD() {
 	V3 res = a ^ b;
 	res.normalize();
 	return res;
-}
\ No newline at end of file
+}
+
+void PPC::SetPose(V3 eye, V3 look_at, V3 up) {
+	V3 old_vd = GetVD();
+	const float f = c * old_vd;
+	const float a_len = a.length(), b_len = b.length();
+	V3 vd = V3(look_at[0] - eye[0], look_at[1] - eye[1], look_at[2] - eye[2]);
+	vd.normalize();
+	// right = vd x up, down = vd x right
+	V3 right = V3(
+		vd[1] * up[2] - vd[2] * up[1],
+		vd[2] * up[0] - vd[0] * up[2],
+		vd[0] * up[1] - vd[1] * up[0]);
+	right.normalize();
+	V3 down = V3(
+		vd[1] * right[2] - vd[2] * right[1],
+		vd[2] * right[0] - vd[0] * right[2],
+		vd[0] * right[1] - vd[1] * right[0]);
+	for (int i = 0; i < 3; i++) {
+		a[i] = right[i] * a_len;
+		b[i] = down[i] * b_len;
+		c[i] = vd[i] * f - a[i] * (float)w * 0.5f - b[i] * (float)h * 0.5f;
+	}
+	C = eye;
+	M = M33(a, b, c);
+	M.transpose();
+	M_inv = M.inverse();
+}
+
+void PPC::GetFrustumPlanes(float* planes) {
+	const float fw = (float)w, fh = (float)h;
+	const float corner_uv[4][2] = { { 0.0f, 0.0f }, { fw, 0.0f }, { fw, fh }, { 0.0f, fh } };
+	float rays[4][3], center[3];
+	for (int i = 0; i < 4; i++) {
+		for (int d = 0; d < 3; d++) {
+			rays[i][d] = a[d] * corner_uv[i][0] + b[d] * corner_uv[i][1] + c[d];
+		}
+	}
+	for (int d = 0; d < 3; d++) {
+		center[d] = a[d] * fw * 0.5f + b[d] * fh * 0.5f + c[d];
+	}
+	for (int i = 0; i < 4; i++) {
+		const float* r0 = rays[i];
+		const float* r1 = rays[(i + 1) & 3];
+		float* pl = planes + i * 4;
+		pl[0] = r0[1] * r1[2] - r0[2] * r1[1];
+		pl[1] = r0[2] * r1[0] - r0[0] * r1[2];
+		pl[2] = r0[0] * r1[1] - r0[1] * r1[0];
+		if (pl[0] * center[0] + pl[1] * center[1] + pl[2] * center[2] < 0.0f) {
+			pl[0] = -pl[0];
+			pl[1] = -pl[1];
+			pl[2] = -pl[2];
+		}
+		pl[3] = -(pl[0] * C[0] + pl[1] * C[1] + pl[2] * C[2]);
+	}
+	V3 vd = GetVD();
+	float* pl = planes + 16;
+	for (int d = 0; d < 3; d++) pl[d] = vd[d];
+	pl[3] = -(vd[0] * C[0] + vd[1] * C[1] + vd[2] * C[2]);
+}
@@ -3,239 +3,1450 @@
 #include <tiffio.h>
 #include <algorithm>
 #include <chrono>
+#include <atomic>
+#include <mutex>
 #include <cmath>
+#include <cfloat>
+#include <emmintrin.h>
+#include <xmmintrin.h>
 
 #include "framebuffer.h"
+#include "Parallel.hpp"
 #include "_Geometry.hpp"
+#include "_Texture.hpp"
+#include "_Shadow.hpp"
 
-#define max3(x, y, z) (max(max((x), (y)), (z)))
-#define min3(x, y, z) (min(min((x), (y)), (z)))
 using namespace std;
 
+thread_local SCREEN_RECT FrameBuffer::clip;
+thread_local RENDER_STATS FrameBuffer::stats;
+
+// fn(lo, hi) as parallel_for jobs, each with its own clip (starting as the
+// caller's) and raster counters, which are added to the caller's stats.
+template <typename F>
+void FrameBuffer::parallelRaster(int begin, int end, F fn) {
+	const SCREEN_RECT outer = clip;
+	RENDER_STATS* total = &stats;
+	mutex merge;
+	parallel_for(begin, end, [&](int lo, int hi) {
+		const SCREEN_RECT saved_clip = clip;
+		const RENDER_STATS saved = stats;
+		clip = outer;
+		stats = RENDER_STATS();
+		fn(lo, hi);
+		const RENDER_STATS counted = stats;
+		stats = saved;
+		clip = saved_clip;
+		lock_guard<mutex> guard(merge);
+		total->addCounters(counted);
+	});
+}
+
 FrameBuffer::FrameBuffer(int u0, int v0, int _w, int _h) : Fl_Gl_Window(u0, v0, _w, _h, 0) {
 	w = _w;
 	h = _h;
-	pix = new unsigned int[w * h];
+	pix = 0;
+	zb = 0;
+	vis = 0;
+	display = 0;
+	sample_pix = 0;
+	sample_z = 0;
+	msaa = MSAA_SAMPLES;
+	damage_all = true;
+	full_presents = 2;
+	allocBuffers();
+	small_tri_path = SMALL_TRIANGLE_PATH;
+	ray_trace = RAY_TRACE;
+	ticking = false;
+	shadow = 0;
 }
 
 void nextFrame(void* window) {
 	auto time_start = std::chrono::system_clock::now();
-	
-	if (PLAY_PONG) {
-		V3& p = scene->ball_pos;
-		V3& v = scene->ball_vel;
-		V3& p1 = scene->player1;
-		V3& p2 = scene->player2;
+	FrameBuffer* fb = (FrameBuffer*) window;
+
+	// real time since the last frame, simulated in fixed ticks (input is
+	// applied at the start of each), drawn interpolated between the last two.
+	static auto last = chrono::high_resolution_clock::now();
+	auto now = chrono::high_resolution_clock::now();
+	scene->sim.advance(chrono::duration<double>(now - last).count(), fb);
+	last = now;
+
+	if (PLAY_PONG) scene->geometry.update_pong(scene->sim.alpha);
+	if (PLAY_TETRIS) scene->geometry.update_tetris();
+
+	if (DIRTY_RECTS) {
+		// idle frames skip rasterization and presentation entirely.
+		if (fb->renderDirty(0)) fb->damage(FL_DAMAGE_USER1);
+	}
+	else {
+		fb->SetBGR(0);
+		fb->applyGeometry();
+		fb->redraw();
+	}
+
+	auto time_end = std::chrono::system_clock::now();
+	float adjustment = 0.033 - (time_end - time_start).count() * 1e-6;
+	if (adjustment < 0) adjustment = 0;
+	// cout << "ADJUSTMENT: " << adjustment << "\n";
+
+	Fl::repeat_timeout(adjustment, nextFrame, window);
+}
+
+void FrameBuffer::startThread() {
+	//tr = thread([this] { this->nextFrame(); });
+	ticking = true;
+	Fl::add_timeout(0.01, nextFrame, this);
+}
 
-		// wall bounce
-		if (p[Dim::X] <= -200 || p[Dim::X] >= 200) {
-			v[Dim::X] *= -1;
+void FrameBuffer::applyGeometry() {
+	job_system().reset_stats();
+	compute.recompute_geometry();
+	clip = SCREEN_RECT(0, 0, w - 1, h - 1);
+	// cleared in row slices, buf_w pixels per row in either layout.
+	parallel_for(0, buf_h, [this](int lo, int hi) {
+		fill(zb + lo * buf_w, zb + hi * buf_w, FLT_MAX);
+		if (VISIBILITY_BUFFER) fill(vis + lo * buf_w, vis + hi * buf_w, VIS_NONE);
+		if (msaa > 1) {
+			// every sample starts as the cleared pixel color.
+			fill(sample_z + lo * buf_w * msaa, sample_z + hi * buf_w * msaa, FLT_MAX);
+			for (int p = lo * buf_w; p < hi * buf_w; p++) {
+				fill(sample_pix + p * msaa, sample_pix + (p + 1) * msaa, pix[p]);
+			}
 		}
+	});
+
+	stats = RENDER_STATS();
+	stats.sort_ms = compute.sort_ms;
+	if (SHADOW_MAPPING && msaa == 1) renderShadowMap();
+
+	if (ray_trace && msaa == 1) {
+		// meshes by ray casting into zb / vis, the rest rasterized against that depth.
+		rayTrace();
+		if (!VISIBILITY_BUFFER) resolveVisibility();
+		rasterBands(false);
+	}
+	else rasterBands();
 
-		// player bounce
-		if (-195 <= p[Dim::Y] && p[Dim::Y] <= -190) {
-			if (p1[Dim::X] <= p[Dim::X] && p[Dim::X] <= p1[Dim::X] + 50)
-				v[Dim::Y] *= -1;
+	// pass 2: shade each covered pixel exactly once.
+	if (msaa > 1) resolveMSAA();
+	else if (VISIBILITY_BUFFER) resolveVisibility();
+	if (SHADOW_MAPPING && msaa == 1) applyShadows();
+	if (TILED_FRAMEBUFFER) detile();
+	damage_all = true;
+	full_presents = 2;
+
+	printStats();
+}
+
+// every computed primitive, in sorted or array order. cull skips the ones
+// whose screen bounds (damage_bounds) miss the clip rect, !meshes skips mesh
+// triangles.
+void FrameBuffer::rasterPrimitives(bool cull, bool meshes) {
+	const int num_mesh_tris = compute.mesh_tri_start.back();
+	// damage_bounds index: segments, spheres, triangles, mesh triangles.
+	const int sphere_base = compute.num_segments;
+	const int triangle_base = sphere_base + compute.num_spheres;
+	const int mesh_base = triangle_base + compute.num_triangles;
+
+	if (SORT_PRIMITIVES) {
+		// front to back, so the depth test rejects as much as possible.
+		for (U32 id : compute.order) {
+			if (!meshes && VIS_TYPE(id) == VIS_MESH) continue;
+			if (cull && !clip.intersects(damage_bounds[boundsIndex(id)])) continue;
+			rasterId(id);
 		}
-		if (190 <= p[Dim::Y] && p[Dim::Y] <= 195) {
-			if (p2[Dim::X] <= p[Dim::X] && p[Dim::X] <= p2[Dim::X] + 50)
-				v[Dim::Y] *= -1;
+		return;
+	}
+	for (int i = 0; i < compute.num_segments; i++) {
+		if (!compute.segment_alive[i]) continue;
+		if (cull && !clip.intersects(damage_bounds[i])) continue;
+		SEGMENT seg = compute.segment(i);
+		rasterSegment(seg, VIS_ID(VIS_SEGMENT, i));
+	}
+	for (int i = 0; i < compute.num_spheres; i++) {
+		if (!compute.sphere_alive[i]) continue;
+		if (cull && !clip.intersects(damage_bounds[sphere_base + i])) continue;
+		SPHERE sph = compute.sphere(i);
+		rasterSphere(sph, VIS_ID(VIS_SPHERE, i));
+	}
+	for (int i = 0; i < compute.num_triangles; i++) {
+		if (!compute.triangle_alive[i]) continue;
+		if (cull && !clip.intersects(damage_bounds[triangle_base + i])) continue;
+		TRIANGLE tri = compute.triangle(i);
+		rasterTriangle(tri, VIS_ID(VIS_TRIANGLE, i));
+	}
+	for (int i = 0; meshes && i < num_mesh_tris; i++) {
+		if (BVH_CULLING && !compute.tri_visible[i]) continue;
+		if (cull && !clip.intersects(damage_bounds[mesh_base + i])) continue;
+		TRIANGLE tri;
+		TRI_ATTRIBS attr;
+		const bool shaded = compute.mesh_triangle(i, tri, &attr);
+		rasterTriangle(tri, VIS_ID(VIS_MESH, i), shaded ? &attr : 0);
+	}
+}
+
+// damage_bounds index of a primitive id.
+int FrameBuffer::boundsIndex(U32 id) {
+	const int i = VIS_INDEX(id);
+	switch (VIS_TYPE(id)) {
+		case VIS_SEGMENT: return i;
+		case VIS_SPHERE: return compute.num_segments + i;
+		case VIS_TRIANGLE: return compute.num_segments + compute.num_spheres + i;
+		default: return compute.num_segments + compute.num_spheres + compute.num_triangles + i;
+	}
+}
+
+void FrameBuffer::rasterId(U32 id) {
+	const U32 i = VIS_INDEX(id);
+	switch (VIS_TYPE(id)) {
+		case VIS_SEGMENT: {
+			SEGMENT seg = compute.segment(i);
+			rasterSegment(seg, id);
+			break;
+		}
+		case VIS_SPHERE: {
+			SPHERE sph = compute.sphere(i);
+			rasterSphere(sph, id);
+			break;
+		}
+		case VIS_TRIANGLE: {
+			TRIANGLE tri = compute.triangle(i);
+			rasterTriangle(tri, id);
+			break;
 		}
+		default: {
+			TRIANGLE tri;
+			TRI_ATTRIBS attr;
+			const bool shaded = compute.mesh_triangle(i, tri, &attr);
+			rasterTriangle(tri, id, shaded ? &attr : 0);
+			break;
+		}
+	}
+}
 
-		// update score
-		if (p[Dim::Y] <= -200) {
-			scene->s2++;
-			cout << "PLAYER 2 SCORED!\n";
-			cout << scene->s1 << " - " << scene->s2 << '\n';
-			scene->ball_pos = V3(0, 0, 0);
+// full frames: primitives are binned (in raster order, slices of the list in
+// parallel) into RASTER_BAND_ROWS row bands by their screen bounds, then
+// every band is rasterized as a job clipped to its rows. bands own their
+// pixels, so no locking.
+void FrameBuffer::rasterBands(bool meshes) {
+	computeDamageBounds();
+	vector<U32> ids;
+	if (!SORT_PRIMITIVES) {
+		const int num_mesh_tris = compute.mesh_tri_start.back();
+		for (int i = 0; i < compute.num_segments; i++) {
+			if (compute.segment_alive[i]) ids.push_back(VIS_ID(VIS_SEGMENT, i));
 		}
-		if (p[Dim::Y] >= 200) {
-			scene->s1++;
-			cout << "PLAYER 1 SCORED!\n";
-			cout << scene->s1 << " - " << scene->s2 << '\n';
-			scene->ball_pos = V3(0, 0, 0);
+		for (int i = 0; i < compute.num_spheres; i++) {
+			if (compute.sphere_alive[i]) ids.push_back(VIS_ID(VIS_SPHERE, i));
+		}
+		for (int i = 0; i < compute.num_triangles; i++) {
+			if (compute.triangle_alive[i]) ids.push_back(VIS_ID(VIS_TRIANGLE, i));
+		}
+		for (int i = 0; meshes && i < num_mesh_tris; i++) {
+			if (!BVH_CULLING || compute.tri_visible[i]) ids.push_back(VIS_ID(VIS_MESH, i));
 		}
-		p += v;
-		scene->geometry.setup_pong();
 	}
-	
-	if (PLAY_NAME_SCROLL) {
-		scene->origin += V3(3.2, 0, 0);
-		if (scene->origin[Dim::X] > scene->w) {
-			scene->origin = V3(0, (float)scene->h * 0.5f, 0.0f);
+	const vector<U32>& order = SORT_PRIMITIVES ? compute.order : ids;
+	const int n = (int)order.size();
+	const int bands = (h + RASTER_BAND_ROWS - 1) / RASTER_BAND_ROWS;
+	const int slices = max(1, min(job_system().threads() * JOB_SPLITS, n / 1024));
+	const int slice = (n + slices - 1) / slices;
+	vector<vector<U32>> bins(slices * bands);
+	parallel_for(0, slices, [&](int lo, int hi) {
+		for (int s = lo; s < hi; s++) {
+			for (int i = s * slice; i < min(n, (s + 1) * slice); i++) {
+				const U32 id = order[i];
+				if (!meshes && VIS_TYPE(id) == VIS_MESH) continue;
+				const SCREEN_RECT& r = damage_bounds[boundsIndex(id)];
+				if (r.empty() || r.x1 < 0 || r.x0 >= w || r.y1 < 0 || r.y0 >= h) continue;
+				const int b0 = max(r.y0, 0) / RASTER_BAND_ROWS, b1 = min(r.y1, h - 1) / RASTER_BAND_ROWS;
+				for (int b = b0; b <= b1; b++) bins[s * bands + b].push_back(id);
+			}
+		}
+	});
+	parallelRaster(0, bands, [&](int lo, int hi) {
+		for (int b = lo; b < hi; b++) {
+			clip = SCREEN_RECT(0, b * RASTER_BAND_ROWS, w - 1, min(h, (b + 1) * RASTER_BAND_ROWS) - 1);
+			for (int s = 0; s < slices; s++) {
+				for (U32 id : bins[s * bands + b]) rasterId(id);
+			}
 		}
+	});
+}
+
+// primary rays through the mesh BVH, one per pixel sample (integer u, v, as
+// the rasterizers sample) inside clip. 2x2
+// pixel packets traverse together, 8x8 pixel tiles of clip are handed to
+// threads from a shared counter. writes camera depth (= ray t, dir has unit c component) and
+// VIS_MESH ids, pix is left to resolveVisibility.
+void FrameBuffer::rayTrace() {
+	auto t1 = chrono::high_resolution_clock::now();
+	compute.update_bvh();
+	PPC* ppc = scene->ppc;
+	const SCREEN_RECT r = clip;
+	const int tiles_x = (r.x1 - r.x0 + TILE_SIZE) / TILE_SIZE;
+	const int tiles = tiles_x * ((r.y1 - r.y0 + TILE_SIZE) / TILE_SIZE);
+	atomic<int> next_tile(0);
+	const int workers = job_system().threads();
+
+	parallel_for(0, workers, [&](int, int) {
+		float origin[3], dirs[12], t_max[4];
+		U32 hit[4];
+		for (int d = 0; d < 3; d++) origin[d] = ppc->C[d];
+		for (int tile = next_tile++; tile < tiles; tile = next_tile++) {
+			const int x0 = r.x0 + (tile % tiles_x) * TILE_SIZE;
+			const int y0 = r.y0 + (tile / tiles_x) * TILE_SIZE;
+			for (int y = y0; y < y0 + TILE_SIZE; y += 2) {
+				for (int x = x0; x < x0 + TILE_SIZE; x += 2) {
+					for (int k = 0; k < 4; k++) {
+						const float u = (float)(x + (k & 1)), v = (float)(y + (k >> 1));
+						for (int d = 0; d < 3; d++) {
+							dirs[d * 4 + k] = ppc->a[d] * u + ppc->b[d] * v + ppc->c[d];
+						}
+						t_max[k] = FLT_MAX;
+						hit[k] = 0xFFFFFFFF;
+					}
+					compute.bvh.intersect4(origin, dirs, t_max, hit);
+					for (int k = 0; k < 4; k++) {
+						const int px = x + (k & 1), py = y + (k >> 1);
+						if (px > r.x1 || py > r.y1) continue;
+						const U32 p = pixel(px, py);
+						zb[p] = t_max[k];
+						vis[p] = hit[k] == 0xFFFFFFFF ? VIS_NONE : VIS_ID(VIS_MESH, hit[k]);
+					}
+				}
+			}
+		}
+	});
+	auto t2 = chrono::high_resolution_clock::now();
+	stats.trace_ms += chrono::duration<double, milli>(t2 - t1).count();
+}
+
+// re-render the light's depth map if the casters (the mesh BVH) or the light
+// changed. returns whether it did.
+bool FrameBuffer::renderShadowMap() {
+	compute.update_bvh();
+	if (!shadow) shadow = new SHADOW_MAP(SHADOW_MAP_SIZE);
+	const bool changed = shadow->render(compute.bvh, scene->light_dir);
+	stats.shadow_ms = shadow->render_ms;
+	return changed;
+}
+
+// darken pixels inside clip that the light's depth map sees occluded. world
+// position from camera depth: C + (a u + b v + c) z.
+void FrameBuffer::applyShadows() {
+	if (!shadow) return;
+	auto t1 = chrono::high_resolution_clock::now();
+	PPC* ppc = scene->ppc;
+	const float ambient = scene->ambient;
+	parallelRaster(clip.y0, clip.y1 + 1, [this, ppc, ambient](int lo, int hi) {
+		for (int y = lo; y < hi; y++) {
+			for (int x = clip.x0; x <= clip.x1; x++) {
+				const U32 p = pixel(x, y);
+				const float z = zb[p];
+				if (z == FLT_MAX) continue;
+				V3 world;
+				for (int d = 0; d < 3; d++) {
+					world[d] = ppc->C[d] + (ppc->a[d] * x + ppc->b[d] * y + ppc->c[d]) * z;
+				}
+				const float lit = shadow->lookup(world);
+				if (lit >= 1.0f) continue;
+				const float k = ambient + (1.0f - ambient) * lit;
+				const U32 c = pix[p];
+				pix[p] = COLOR((U32)((c & 255) * k), (U32)(((c >> 8) & 255) * k), (U32)(((c >> 16) & 255) * k));
+			}
+		}
+	});
+	auto t2 = chrono::high_resolution_clock::now();
+	stats.shadow_lookup_ms += chrono::duration<double, milli>(t2 - t1).count();
+}
+
+void FrameBuffer::printStats() {
+	if (PRINT_RENDER_STATS) {
+		cout << "sort: " << stats.sort_ms << " ms, depth tests: " << stats.depth_tests
+			<< ", rejected: " << stats.reject_rate() * 100.0f << "%"
+			<< ", small triangles: " << stats.small_triangles
+			<< ", reprojected: " << compute.reprojected
+			<< ", culled: " << compute.culled
+			<< ", ray trace: " << stats.trace_ms << " ms"
+			<< ", shadow map: " << stats.shadow_ms << " ms (lookups " << stats.shadow_lookup_ms << " ms)"
+			<< ", dirty rects: " << stats.dirty_rects << " (" << stats.dirty_pixels << " px)\n";
+		input_stats.dropped += input.dropped.exchange(0, memory_order_relaxed);
+		if (input_stats.events || input_stats.dropped || input_stats.discarded) {
+			cout << "input: " << input_stats.events << " events, latency " << input_stats.average_ms()
+				<< " ms avg, " << input_stats.max_ms << " ms max, dropped: " << input_stats.dropped
+				<< ", discarded: " << input_stats.discarded << "\n";
+			input_stats = INPUT_STATS();
+		}
+		JOB_STATS jobs = job_system().stats();
+		cout << "jobs: " << jobs.tasks << " tasks, " << jobs.steals << " steals, " << jobs.idle_ms << " ms idle over "
+			<< job_system().threads() << " threads\n";
+		for (STREAMED_MESH* stream : scene->geometry.streams) {
+			cout << "stream: " << stream->visible << "/" << stream->clusters.size() << " clusters visible, "
+				<< (stream->resident_size() >> 20) << " MB resident, loads: " << stream->loads
+				<< ", evictions: " << stream->evictions << ", prefetched: " << stream->prefetched
+				<< ", skipped over budget: " << stream->skipped << "\n";
+		}
+		if (TERRAIN* terrain = scene->geometry.terrain) {
+			cout << "terrain: " << terrain->visible << " chunks drawn, " << terrain->generated << " generated\n";
+		}
+	}
+}
+
+// conservative pixel bounds of a projected primitive (stroke / radius + 1 px).
+static inline SCREEN_RECT pointBounds(V3* v, int n, int pad) {
+	float min_x = v[0][Dim::X], max_x = min_x;
+	float min_y = v[0][Dim::Y], max_y = min_y;
+	for (int i = 1; i < n; i++) {
+		min_x = min(min_x, v[i][Dim::X]);
+		max_x = max(max_x, v[i][Dim::X]);
+		min_y = min(min_y, v[i][Dim::Y]);
+		max_y = max(max_y, v[i][Dim::Y]);
 	}
+	// clamp before the int cast, projected points can be far off screen.
+	const float limit = 1 << 20;
+	min_x = max(-limit, min(min_x, limit));
+	max_x = max(-limit, min(max_x, limit));
+	min_y = max(-limit, min(min_y, limit));
+	max_y = max(-limit, min(max_y, limit));
+	return SCREEN_RECT((int)floor(min_x) - pad, (int)floor(min_y) - pad,
+		(int)ceil(max_x) + pad, (int)ceil(max_y) + pad);
+}
 
-	if (PLAY_TETRIS) {
-		if (scene->curr_shape == -1) {
-			scene->add_shape();
+// FNV-1a over the projected primitive, so color / shape changes that keep
+// the same bounds are still damage.
+static inline U32 primitiveKey(const void* data, size_t bytes) {
+	const unsigned char* c = (const unsigned char*)data;
+	U32 key = 2166136261u;
+	for (size_t i = 0; i < bytes; i++) {
+		key = (key ^ c[i]) * 16777619u;
+	}
+	return key;
+}
+
+// bounds + key of every computed primitive, in rasterPrimitives index order.
+// each section in parallel slices.
+void FrameBuffer::computeDamageBounds() {
+	const int num_mesh_tris = compute.mesh_tri_start.back();
+	const size_t n = compute.num_segments + compute.num_spheres + compute.num_triangles + num_mesh_tris;
+	damage_bounds.resize(n);
+	damage_keys.resize(n);
+	const int sphere_base = compute.num_segments;
+	const int triangle_base = sphere_base + compute.num_spheres;
+	const int mesh_base = triangle_base + compute.num_triangles;
+	parallel_for(0, compute.num_segments, [this](int lo, int hi) {
+		for (int i = lo; i < hi; i++) {
+			if (!compute.segment_alive[i]) {
+				damage_bounds[i] = SCREEN_RECT();
+				damage_keys[i] = 0;
+				continue;
+			}
+			SEGMENT seg = compute.segment(i);
+			V3 ends[2] = { seg.start, seg.end };
+			damage_bounds[i] = pointBounds(ends, 2, (seg.width >> 1) + 1);
+			damage_keys[i] = primitiveKey(&seg, sizeof(seg));
 		}
-		else {
-			scene->drop_shape();
+	});
+	parallel_for(0, compute.num_spheres, [this, sphere_base](int lo, int hi) {
+		for (int i = lo; i < hi; i++) {
+			const int k = sphere_base + i;
+			if (!compute.sphere_alive[i]) {
+				damage_bounds[k] = SCREEN_RECT();
+				damage_keys[k] = 0;
+				continue;
+			}
+			SPHERE sph = compute.sphere(i);
+			damage_bounds[k] = pointBounds(&sph.point, 1, (sph.width >> 1) + 1);
+			damage_keys[k] = primitiveKey(&sph, sizeof(sph));
+		}
+	});
+	parallel_for(0, compute.num_triangles, [this, triangle_base](int lo, int hi) {
+		for (int i = lo; i < hi; i++) {
+			const int k = triangle_base + i;
+			if (!compute.triangle_alive[i]) {
+				damage_bounds[k] = SCREEN_RECT();
+				damage_keys[k] = 0;
+				continue;
+			}
+			TRIANGLE tri = compute.triangle(i);
+			damage_bounds[k] = pointBounds(tri.points, 3, 2);
+			damage_keys[k] = primitiveKey(&tri, sizeof(tri));
+		}
+	});
+	parallel_for(0, num_mesh_tris, [this, mesh_base](int lo, int hi) {
+		for (int i = lo; i < hi; i++) {
+			// culled ranges keep stale projections, they aren't drawn either.
+			if (BVH_CULLING && !compute.tri_visible[i]) {
+				damage_bounds[mesh_base + i] = SCREEN_RECT();
+				damage_keys[mesh_base + i] = 0;
+				continue;
+			}
+			TRIANGLE tri;
+			TRI_ATTRIBS attr;
+			compute.mesh_triangle(i, tri, &attr);
+			damage_bounds[mesh_base + i] = pointBounds(tri.points, 3, 2);
+			U32 key = primitiveKey(&tri, sizeof(tri));
+			if (attr.lit) key ^= primitiveKey(attr.cols, sizeof(attr.cols));
+			damage_keys[mesh_base + i] = key;
+		}
+	});
+}
+
+// add r (clipped to the screen) to the dirty list, merging overlapping rects.
+void FrameBuffer::addDirtyRect(SCREEN_RECT r) {
+	r = r.intersection(SCREEN_RECT(0, 0, w - 1, h - 1));
+	if (r.empty()) return;
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		for (size_t i = 0; i < dirty.size(); i++) {
+			if (!dirty[i].intersects(r)) continue;
+			r = r.merge(dirty[i]);
+			dirty.erase(dirty.begin() + i);
+			merged = true;
+			break;
 		}
-		scene->geometry.setup_tetris();
 	}
+	dirty.push_back(r);
+	// past a handful of rects the bookkeeping costs more than the overdraw.
+	if (dirty.size() > MAX_DIRTY_RECTS) {
+		SCREEN_RECT all = dirty[0];
+		for (SCREEN_RECT& d : dirty) all = all.merge(d);
+		dirty.assign(1, all);
+	}
+}
 
-	FrameBuffer* fb = (FrameBuffer*) window;
-	fb->SetBGR(0);
-	fb->applyGeometry();
-	fb->redraw();
+// redraw only what moved since the last frame: primitives whose bounds or
+// key changed mark their old and new bounds dirty, each dirty rect is cleared
+// to bgr and re-rasterized with everything that overlaps it. returns whether
+// anything was drawn (false = the previous frame is still valid).
+bool FrameBuffer::renderDirty(unsigned int bgr) {
+	if (msaa > 1) {
+		// the sample buffers are not tracked, full frames only.
+		SetBGR(bgr);
+		applyGeometry();
+		return true;
+	}
 
-	auto time_end = std::chrono::system_clock::now();
-	float adjustment = 0.033 - (time_end - time_start).count() * 1e-6;
-	if (adjustment < 0) adjustment = 0;
-	// cout << "ADJUSTMENT: " << adjustment << "\n";
+	job_system().reset_stats();
+	compute.recompute_geometry();
+	stats = RENDER_STATS();
+	stats.sort_ms = compute.sort_ms;
+	// a new shadow map can darken anything, not just what moved.
+	if (SHADOW_MAPPING && renderShadowMap()) damage_all = true;
 
-	Fl::repeat_timeout(adjustment, nextFrame, window);
+	vector<SCREEN_RECT> old_bounds;
+	vector<U32> old_keys;
+	old_bounds.swap(damage_bounds);
+	old_keys.swap(damage_keys);
+	computeDamageBounds();
+
+	dirty.clear();
+	if (damage_all || old_keys.size() != damage_keys.size()) {
+		addDirtyRect(SCREEN_RECT(0, 0, w - 1, h - 1));
+	}
+	else {
+		for (size_t i = 0; i < damage_keys.size(); i++) {
+			if (old_keys[i] == damage_keys[i] && old_bounds[i] == damage_bounds[i]) continue;
+			addDirtyRect(old_bounds[i]);
+			addDirtyRect(damage_bounds[i]);
+		}
+	}
+	damage_all = false;
+	if (dirty.empty()) return false;
+
+	for (SCREEN_RECT& r : dirty) {
+		clip = r;
+		// row slices of the rect as jobs: clear, then (after tracing) everything overlapping.
+		parallelRaster(r.y0, r.y1 + 1, [this, r, bgr](int lo, int hi) {
+			for (int y = lo; y < hi; y++) {
+				for (int x = r.x0; x <= r.x1; x++) {
+					const U32 p = pixel(x, y);
+					pix[p] = bgr;
+					zb[p] = FLT_MAX;
+					if (VISIBILITY_BUFFER) vis[p] = VIS_NONE;
+				}
+			}
+		});
+		if (ray_trace) {
+			// meshes traced inside the rect, the rest rasterized against that depth.
+			rayTrace();
+			if (!VISIBILITY_BUFFER) resolveVisibility();
+		}
+		parallelRaster(r.y0, r.y1 + 1, [this, r](int lo, int hi) {
+			clip = SCREEN_RECT(r.x0, lo, r.x1, hi - 1);
+			rasterPrimitives(true, !ray_trace);
+		});
+		if (VISIBILITY_BUFFER) resolveVisibility();
+		if (SHADOW_MAPPING) applyShadows();
+		stats.dirty_rects++;
+		stats.dirty_pixels += r.area();
+		present_rows = present_rows.empty() ? r : present_rows.merge(r);
+	}
+	clip = SCREEN_RECT(0, 0, w - 1, h - 1);
+	if (TILED_FRAMEBUFFER) detile();
+	printStats();
+	return true;
 }
 
-void FrameBuffer::startThread() {
-	//tr = thread([this] { this->nextFrame(); });
-	Fl::add_timeout(0.01, nextFrame, this);
+// squared distance (ignoring z) from pixel to segment, z of the closest point.
+static inline float segmentDistSq(SEGMENT& segment, V3& line_vec, float x, float y, float& z) {
+	V3& start = segment.start;
+	// project delta onto segment as if z = 0
+	float dx = x - start[Dim::X];
+	float dy = y - start[Dim::Y];
+	const float proj_num = dx * line_vec[Dim::X] + dy * line_vec[Dim::Y];
+	V3 proj = line_vec * proj_num;
+
+	// calculate distance while ignoring z.
+	dx -= proj[Dim::X];
+	dy -= proj[Dim::Y];
+	z = proj[Dim::Z] + start[Dim::Z];
+	return dx * dx + dy * dy;
 }
 
-void FrameBuffer::applyGeometry() {
-	compute = COMPUTED_GEOMETRY();
-	vector<float> z_index(w * h, FLT_MAX);
+// compute line_vec unit vector as if z = 0
+static inline V3 segmentLineVec(SEGMENT& segment) {
+	V3 line_vec = segment.end - segment.start;
+	float proj_den = line_vec[Dim::X] * line_vec[Dim::X] + line_vec[Dim::Y] * line_vec[Dim::Y];
+	line_vec *= 1 / sqrt(proj_den);
+	return line_vec;
+}
 
-	for (int i = 0; i < compute.num_segments; i++) {
-		SEGMENT& segment = compute.segments[i];
-		V3& start = segment.start;
-		V3& end = segment.end;
-		const U32 HALF_STROKE = segment.width >> 1;
-		const U32 HALF_STROKE_SQUARE = HALF_STROKE * HALF_STROKE;
-
-		// determine box
-		U32 min_x = (U32)(min(start[Dim::X], end[Dim::X]) + 0.5f) - HALF_STROKE;
-		if (min_x < 0) min_x = 0;
-		U32 min_y = (U32)(min(start[Dim::Y], end[Dim::Y]) + 0.5f) - HALF_STROKE;
-		if (min_y < 0) min_y = 0;
-		U32 max_x = (U32)(max(start[Dim::X], end[Dim::X]) - 0.5f) + HALF_STROKE;
-		if (max_x >= w) max_x = w - 1;
-		U32 max_y = (U32)(max(start[Dim::Y], end[Dim::Y]) - 0.5f) + HALF_STROKE;
-		if (max_y >= h) max_y = h - 1;
-
-		// compute line_vec unit vector as if z = 0
-		V3 line_vec = end - start;
-		float proj_den = line_vec[Dim::X] * line_vec[Dim::X] + line_vec[Dim::Y] * line_vec[Dim::Y];
-		line_vec *= 1 / sqrt(proj_den);
-
-		// iterate over box pixels
-		for (U32 y = min_y; y <= max_y; y++) {
-			for (U32 x = min_x; x <= max_x; x++) {
-				// project delta onto segment as if z = 0
-				float dx = x - start[Dim::X];
-				float dy = y - start[Dim::Y];
-				const float proj_num = dx * line_vec[Dim::X] + dy * line_vec[Dim::Y];
-				V3 proj = line_vec * proj_num;
-
-				// calculate distance while ignoring z.
-				dx -= proj[Dim::X];
-				dy -= proj[Dim::Y];
-				const float dist_sq = dx * dx + dy * dy;
-
-				// determine squared distance from segment
-				if (HALF_STROKE_SQUARE < dist_sq) continue;
-
-				// check if z if high enough to render over another item.
-				const float z_value = proj[Dim::Z] + start[Dim::Z];
-				const U32 p = y * w + x;
-				if (z_value > z_index[p]) continue;
-				z_index[p] = z_value;
-
-				// overwrite pixel color
+// index of pixel (x, y) in pix / zb / vis. tiled: 8x8 tiles in row
+// order, row major inside a tile, so tall primitives stay cache local.
+inline U32 FrameBuffer::pixel(int x, int y) {
+	if (!TILED_FRAMEBUFFER) return y * w + x;
+	const U32 tile_index = (y >> TILE_SHIFT) * (buf_w >> TILE_SHIFT) + (x >> TILE_SHIFT);
+	return (tile_index << (2 * TILE_SHIFT)) + ((y & (TILE_SIZE - 1)) << TILE_SHIFT) + (x & (TILE_SIZE - 1));
+}
+
+void FrameBuffer::rasterSegment(SEGMENT& segment, U32 id) {
+	V3& start = segment.start;
+	V3& end = segment.end;
+	const U32 HALF_STROKE = segment.width >> 1;
+	const U32 HALF_STROKE_SQUARE = HALF_STROKE * HALF_STROKE;
+
+	// determine box, clipped to the clip rect
+	int min_x = (int)(min(start[Dim::X], end[Dim::X]) + 0.5f) - (int)HALF_STROKE;
+	if (min_x < clip.x0) min_x = clip.x0;
+	int min_y = (int)(min(start[Dim::Y], end[Dim::Y]) + 0.5f) - (int)HALF_STROKE;
+	if (min_y < clip.y0) min_y = clip.y0;
+	int max_x = (int)(max(start[Dim::X], end[Dim::X]) - 0.5f) + (int)HALF_STROKE;
+	if (max_x > clip.x1) max_x = clip.x1;
+	int max_y = (int)(max(start[Dim::Y], end[Dim::Y]) - 0.5f) + (int)HALF_STROKE;
+	if (max_y > clip.y1) max_y = clip.y1;
+
+	V3 line_vec = segmentLineVec(segment);
+
+	// iterate over box pixels
+	for (int y = min_y; y <= max_y; y++) {
+		for (int x = min_x; x <= max_x; x++) {
+			// determine squared distance from segment
+			float z_value;
+			const float dist_sq = segmentDistSq(segment, line_vec, (float)x, (float)y, z_value);
+			if (HALF_STROKE_SQUARE < dist_sq) continue;
+
+			// check if z if high enough to render over another item.
+			const U32 p = pixel(x, y);
+			if (msaa > 1) {
 				const float d = min(HALF_STROKE_SQUARE - dist_sq, 5.0f);
-				pix[p] = segment.scaleColor(0.2f * d);
+				const float z[8] = { z_value, z_value, z_value, z_value, z_value, z_value, z_value, z_value };
+				writeSamples(p, (1 << msaa) - 1, z, segment.scaleColor(0.2f * d));
+				continue;
+			}
+			stats.depth_tests++;
+			if (z_value > zb[p]) {
+				stats.depth_rejects++;
+				continue;
 			}
+			zb[p] = z_value;
+
+			// defer shading to the resolve pass.
+			if (VISIBILITY_BUFFER) {
+				vis[p] = id;
+				continue;
+			}
+
+			// overwrite pixel color
+			const float d = min(HALF_STROKE_SQUARE - dist_sq, 5.0f);
+			pix[p] = segment.scaleColor(0.2f * d);
 		}
 	}
+}
 
-	for (int i = 0; i < compute.num_spheres; i++) {
-		SPHERE& sphere = compute.spheres[i];
-		V3& point = sphere.point;
-		const U32 HALF_DOT = sphere.width >> 1;
-		const U32 HALF_DOT_SQUARE = HALF_DOT * HALF_DOT;
-
-		U32 min_x = (U32)(point[Dim::X] + 0.5f) - HALF_DOT;
-		if (min_x < 0) min_x = 0;
-		U32 min_y = (U32)(point[Dim::Y] + 0.5f) - HALF_DOT;
-		if (min_y < 0) min_y = 0;
-		U32 max_x = (U32)(point[Dim::X] - 0.5f) + HALF_DOT;
-		if (max_x >= w) max_x = w - 1;
-		U32 max_y = (U32)(point[Dim::Y] - 0.5f) + HALF_DOT;
-		if (max_y >= h) max_y = h - 1;
-
-		for (U32 y = min_y; y <= max_y; y++) {
-			for (U32 x = min_x; x <= max_x; x++) {
-				// project delta onto segment as if z = 0
-				float dx = x - point[Dim::X];
-				float dy = y - point[Dim::Y];
-				const float dist_sq = dx * dx + dy * dy;
-
-				// determine squared distance from point
-				if (HALF_DOT_SQUARE < dist_sq) continue;
-
-				// check if z if high enough to render over another item.
-				const U32 p = y * w + x;
-				if (point[Dim::Z] > z_index[p]) continue;
-				z_index[p] = point[Dim::Z];
-
-				// overwrite pixel color
+void FrameBuffer::rasterSphere(SPHERE& sphere, U32 id) {
+	V3& point = sphere.point;
+	const U32 HALF_DOT = sphere.width >> 1;
+	const U32 HALF_DOT_SQUARE = HALF_DOT * HALF_DOT;
+
+	int min_x = (int)(point[Dim::X] + 0.5f) - (int)HALF_DOT;
+	if (min_x < clip.x0) min_x = clip.x0;
+	int min_y = (int)(point[Dim::Y] + 0.5f) - (int)HALF_DOT;
+	if (min_y < clip.y0) min_y = clip.y0;
+	int max_x = (int)(point[Dim::X] - 0.5f) + (int)HALF_DOT;
+	if (max_x > clip.x1) max_x = clip.x1;
+	int max_y = (int)(point[Dim::Y] - 0.5f) + (int)HALF_DOT;
+	if (max_y > clip.y1) max_y = clip.y1;
+
+	for (int y = min_y; y <= max_y; y++) {
+		for (int x = min_x; x <= max_x; x++) {
+			// project delta onto segment as if z = 0
+			float dx = x - point[Dim::X];
+			float dy = y - point[Dim::Y];
+			const float dist_sq = dx * dx + dy * dy;
+
+			// determine squared distance from point
+			if (HALF_DOT_SQUARE < dist_sq) continue;
+
+			// check if z if high enough to render over another item.
+			const U32 p = pixel(x, y);
+			if (msaa > 1) {
 				const float d = min(HALF_DOT_SQUARE - dist_sq, 5.0f);
-				pix[p] = sphere.scaleColor(0.2f * d);
+				const float z_value = point[Dim::Z];
+				const float z[8] = { z_value, z_value, z_value, z_value, z_value, z_value, z_value, z_value };
+				writeSamples(p, (1 << msaa) - 1, z, sphere.scaleColor(0.2f * d));
+				continue;
+			}
+			stats.depth_tests++;
+			if (point[Dim::Z] > zb[p]) {
+				stats.depth_rejects++;
+				continue;
+			}
+			zb[p] = point[Dim::Z];
+
+			// defer shading to the resolve pass.
+			if (VISIBILITY_BUFFER) {
+				vis[p] = id;
+				continue;
 			}
+
+			// overwrite pixel color
+			const float d = min(HALF_DOT_SQUARE - dist_sq, 5.0f);
+			pix[p] = sphere.scaleColor(0.2f * d);
 		}
 	}
+}
 
-	// cool method inspired by vector field curl
-	for (int i = 0; i < compute.num_triangles; i++) {
-		TRIANGLE& tri = compute.triangles[i];
-		V3 p1 = tri.points[0]; p1[Dim::Z] = 0.0f;
-		V3 p2 = tri.points[1]; p2[Dim::Z] = 0.0f;
-		V3 p3 = tri.points[2]; p3[Dim::Z] = 0.0f;
-		// make vectors that almost curve around the triangle.
-		V3 c1 = p1 - p3;
-		V3 c2 = p3 - p2;
-		V3 c3 = p2 - p1;
-
-		// determine box
-		U32 min_x = (U32)(min3(p1[Dim::X], p2[Dim::X], p3[Dim::X]) + 0.5f);
-		if (min_x < 0) min_x = 0;
-		U32 min_y = (U32)(min3(p1[Dim::Y], p2[Dim::Y], p3[Dim::Y]) + 0.5f);
-		if (min_y < 0) min_y = 0;
-		U32 max_x = (U32)(max3(p1[Dim::X], p2[Dim::X], p3[Dim::X]) - 0.5f);
-		if (max_x >= w) max_x = w - 1;
-		U32 max_y = (U32)(max3(p1[Dim::Y], p2[Dim::Y], p3[Dim::Y]) - 0.5f);
-		if (max_y >= h) max_y = h - 1;
-
-		for (U32 y = min_y; y <= max_y; y++) {
-			for (U32 x = min_x; x <= max_x; x++) {
-				V3 pos = V3((float)x, (float)y, 0.0f);
-				V3 d1 = pos - p3;
-				V3 d2 = pos - p2;
-				V3 d3 = pos - p1;
-				// cross product all, extract z (only non-zero value)
-				V3 r1 = d1 ^ c1;
-				V3 r2 = d2 ^ c2;
-				V3 r3 = d3 ^ c3;
-				float cross1 = r1[Dim::Z];
-				float cross2 = r2[Dim::Z];
-				float cross3 = r3[Dim::Z];
-				// matching signs = inside the triangle
-				if ((cross1 < 0 && cross2 < 0 && cross3 < 0)
-					|| (cross1 > 0 && cross2 > 0 && cross3 > 0)) {
-					const U32 p = y * w + x;
-					if (0 > z_index[p]) continue;
-					z_index[p] = 0;
-					pix[p] = tri.color;
+// cool method inspired by vector field curl
+void FrameBuffer::rasterTriangle(TRIANGLE& tri, U32 id, TRI_ATTRIBS* attr) {
+	// high poly meshes are mostly triangles covering a few pixels.
+	if (small_tri_path && msaa == 1) {
+		V3* v = tri.points;
+		const float span_x = max3(v[0][Dim::X], v[1][Dim::X], v[2][Dim::X]) - min3(v[0][Dim::X], v[1][Dim::X], v[2][Dim::X]);
+		const float span_y = max3(v[0][Dim::Y], v[1][Dim::Y], v[2][Dim::Y]) - min3(v[0][Dim::Y], v[1][Dim::Y], v[2][Dim::Y]);
+		if (span_x < SMALL_TRIANGLE_SPAN && span_y < SMALL_TRIANGLE_SPAN) {
+			rasterSmallTriangle(tri, id, attr);
+			return;
+		}
+	}
+	if (msaa > 1) {
+		rasterTriangleMSAA(tri, attr);
+		return;
+	}
+	if (attr) {
+		rasterTriangleShaded(tri, id, *attr);
+		return;
+	}
+	if (FIXED_POINT_RASTER) {
+		rasterTriangleFixed(tri, id);
+		return;
+	}
+
+	V3 p1 = tri.points[0]; p1[Dim::Z] = 0.0f;
+	V3 p2 = tri.points[1]; p2[Dim::Z] = 0.0f;
+	V3 p3 = tri.points[2]; p3[Dim::Z] = 0.0f;
+	// make vectors that almost curve around the triangle.
+	V3 c1 = p1 - p3;
+	V3 c2 = p3 - p2;
+	V3 c3 = p2 - p1;
+
+	// each cross is weighted by the vertex opposite its edge.
+	const float z1 = tri.points[0][Dim::Z];
+	const float z2 = tri.points[1][Dim::Z];
+	const float z3 = tri.points[2][Dim::Z];
+
+	// determine box, clipped to the clip rect
+	int min_x = (int)(min3(p1[Dim::X], p2[Dim::X], p3[Dim::X]) + 0.5f);
+	if (min_x < clip.x0) min_x = clip.x0;
+	int min_y = (int)(min3(p1[Dim::Y], p2[Dim::Y], p3[Dim::Y]) + 0.5f);
+	if (min_y < clip.y0) min_y = clip.y0;
+	int max_x = (int)(max3(p1[Dim::X], p2[Dim::X], p3[Dim::X]) - 0.5f);
+	if (max_x > clip.x1) max_x = clip.x1;
+	int max_y = (int)(max3(p1[Dim::Y], p2[Dim::Y], p3[Dim::Y]) - 0.5f);
+	if (max_y > clip.y1) max_y = clip.y1;
+
+	for (int y = min_y; y <= max_y; y++) {
+		for (int x = min_x; x <= max_x; x++) {
+			V3 pos = V3((float)x, (float)y, 0.0f);
+			V3 d1 = pos - p3;
+			V3 d2 = pos - p2;
+			V3 d3 = pos - p1;
+			// cross product all, extract z (only non-zero value)
+			V3 r1 = d1 ^ c1;
+			V3 r2 = d2 ^ c2;
+			V3 r3 = d3 ^ c3;
+			float cross1 = r1[Dim::Z];
+			float cross2 = r2[Dim::Z];
+			float cross3 = r3[Dim::Z];
+			// matching signs = inside the triangle
+			if ((cross1 < 0 && cross2 < 0 && cross3 < 0)
+				|| (cross1 > 0 && cross2 > 0 && cross3 > 0)) {
+				const float z_value = (cross2 * z1 + cross1 * z2 + cross3 * z3) / (cross1 + cross2 + cross3);
+				const U32 p = pixel(x, y);
+				stats.depth_tests++;
+				if (z_value > zb[p]) {
+					stats.depth_rejects++;
+					continue;
 				}
+				zb[p] = z_value;
+				if (VISIBILITY_BUFFER) vis[p] = id;
+				else pix[p] = tri.color;
 			}
 		}
 	}
 }
 
+// float rgb (0..255) to a pixel, clamped against interpolation overshoot.
+static inline U32 packColor(float r, float g, float b) {
+	U32 ri = (U32)max(0.0f, min(r, 255.0f));
+	U32 gi = (U32)max(0.0f, min(g, 255.0f));
+	U32 bi = (U32)max(0.0f, min(b, 255.0f));
+	return COLOR(ri, gi, bi);
+}
+
+// texel times lit rgb (0..255).
+static inline U32 modulateColor(U32 texel, float r, float g, float b) {
+	const float s = 1.0f / 255.0f;
+	return packColor(
+		(texel & 255) * r * s,
+		((texel >> 8) & 255) * g * s,
+		((texel >> 16) & 255) * b * s);
+}
+
+// snap to the 28.4 subpixel grid, clamped so edge products stay inside 64 bits.
+static inline int toFixed(float v) {
+	const float limit = (float)(1 << 26);
+	v = max(-limit, min(v, limit));
+	return (int)floor(v * SUBPIXEL_ONE + 0.5f);
+}
+
+// top-left rule: pixels exactly on a shared edge belong to one triangle only.
+static inline bool isTopLeft(int ax, int ay, int bx, int by) {
+	return (by > ay) || (by == ay && bx < ax);
+}
+
+// snapped triangle with edge functions evaluated at the box origin.
+class TRI_SETUP {
+public:
+	int vx[3], vy[3];
+	float vz[3];
+	long long area;
+	bool flipped; // vertices 1 and 2 were swapped to wind counter clockwise
+	int min_x, min_y, max_x, max_y;
+	// edge i runs between the two vertices opposite vertex i.
+	long long ex[3], ey[3];
+	long long row[3], step_x[3], step_y[3];
+};
+
+// snap, wind counter clockwise and bound a triangle. pad grows the box by
+// whole pixels for sample patterns that reach outside the pixel center.
+static bool setupTriangleFixed(TRIANGLE& tri, int pad, SCREEN_RECT& clip, TRI_SETUP& t) {
+	for (int i = 0; i < 3; i++) {
+		t.vx[i] = toFixed(tri.points[i][Dim::X]);
+		t.vy[i] = toFixed(tri.points[i][Dim::Y]);
+		t.vz[i] = tri.points[i][Dim::Z];
+	}
+
+	// counter clockwise winding so inside = all edges non-negative.
+	t.area = (long long)(t.vx[1] - t.vx[0]) * (t.vy[2] - t.vy[0])
+		- (long long)(t.vy[1] - t.vy[0]) * (t.vx[2] - t.vx[0]);
+	if (t.area == 0) return false;
+	t.flipped = t.area < 0;
+	if (t.flipped) {
+		swap(t.vx[1], t.vx[2]);
+		swap(t.vy[1], t.vy[2]);
+		swap(t.vz[1], t.vz[2]);
+		t.area = -t.area;
+	}
+
+	// determine box on the pixel grid (samples sit on integer coordinates).
+	t.min_x = max(((min3(t.vx[0], t.vx[1], t.vx[2]) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS) - pad, clip.x0);
+	t.min_y = max(((min3(t.vy[0], t.vy[1], t.vy[2]) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS) - pad, clip.y0);
+	t.max_x = min((max3(t.vx[0], t.vx[1], t.vx[2]) >> SUBPIXEL_BITS) + pad, clip.x1);
+	t.max_y = min((max3(t.vy[0], t.vy[1], t.vy[2]) >> SUBPIXEL_BITS) + pad, clip.y1);
+	if (t.min_x > t.max_x || t.min_y > t.max_y) return false;
+
+	const long long px = (long long)t.min_x << SUBPIXEL_BITS;
+	const long long py = (long long)t.min_y << SUBPIXEL_BITS;
+	for (int i = 0; i < 3; i++) {
+		const int a = (i + 1) % 3;
+		const int b = (i + 2) % 3;
+		t.ex[i] = t.vx[b] - t.vx[a];
+		t.ey[i] = t.vy[b] - t.vy[a];
+		t.row[i] = t.ex[i] * (py - t.vy[a]) - t.ey[i] * (px - t.vx[a]);
+		if (!isTopLeft(t.vx[a], t.vy[a], t.vx[b], t.vy[b])) t.row[i] -= 1;
+		t.step_x[i] = -t.ey[i] << SUBPIXEL_BITS;
+		t.step_y[i] = t.ex[i] << SUBPIXEL_BITS;
+	}
+	return true;
+}
+
+// exact integer edge functions, stepped incrementally per pixel.
+void FrameBuffer::rasterTriangleFixed(TRIANGLE& tri, U32 id) {
+	TRI_SETUP t;
+	if (!setupTriangleFixed(tri, 0, clip, t)) return;
+
+	long long row[3] = { t.row[0], t.row[1], t.row[2] };
+	const float inv_area = 1.0f / (float)t.area;
+	for (int y = t.min_y; y <= t.max_y; y++) {
+		long long e0 = row[0], e1 = row[1], e2 = row[2];
+		for (int x = t.min_x; x <= t.max_x; x++) {
+			// all three signs clear = inside.
+			if ((e0 | e1 | e2) >= 0) {
+				const float z_value = ((float)e0 * t.vz[0] + (float)e1 * t.vz[1] + (float)e2 * t.vz[2]) * inv_area;
+				const U32 p = pixel(x, y);
+				stats.depth_tests++;
+				if (z_value > zb[p]) {
+					stats.depth_rejects++;
+				}
+				else {
+					zb[p] = z_value;
+					if (VISIBILITY_BUFFER) vis[p] = id;
+					else pix[p] = tri.color;
+				}
+			}
+			e0 += t.step_x[0];
+			e1 += t.step_x[1];
+			e2 += t.step_x[2];
+		}
+		row[0] += t.step_y[0];
+		row[1] += t.step_y[1];
+		row[2] += t.step_y[2];
+	}
+}
+
+// d/dx and d/dy of an attribute that is linear over the triangle's screen plane.
+static inline void attributeGradient(V3* v, float a0, float a1, float a2, float& dadx, float& dady) {
+	const float x1 = v[1][Dim::X] - v[0][Dim::X], y1 = v[1][Dim::Y] - v[0][Dim::Y];
+	const float x2 = v[2][Dim::X] - v[0][Dim::X], y2 = v[2][Dim::Y] - v[0][Dim::Y];
+	const float inv_det = 1.0f / (x1 * y2 - x2 * y1);
+	dadx = ((a1 - a0) * y2 - (a2 - a0) * y1) * inv_det;
+	dady = ((a2 - a0) * x1 - (a1 - a0) * x2) * inv_det;
+}
+
+// lit color and/or perspective correct texture at barycentric weights b
+// (original vertex order). lod is in mip levels.
+U32 FrameBuffer::shadeAttribs(TRIANGLE& tri, TRI_ATTRIBS& attr, float b0, float b1, float b2, float lod) {
+	U32 color = tri.color;
+	if (attr.texture) {
+		// 1 / depth interpolates linearly in screen space, uv / depth too.
+		const float q = b0 * attr.q[0] + b1 * attr.q[1] + b2 * attr.q[2];
+		const float inv_q = 1.0f / q;
+		const float u = (b0 * attr.uv[0] * attr.q[0] + b1 * attr.uv[2] * attr.q[1] + b2 * attr.uv[4] * attr.q[2]) * inv_q;
+		const float v = (b0 * attr.uv[1] * attr.q[0] + b1 * attr.uv[3] * attr.q[1] + b2 * attr.uv[5] * attr.q[2]) * inv_q;
+		const float size = (float)attr.texture->size;
+		stats.texture_fetches++;
+		color = attr.texture->Sample(u * size, v * size, lod);
+	}
+	if (attr.lit) {
+		V3* c = attr.cols;
+		const float r = b0 * c[0][0] + b1 * c[1][0] + b2 * c[2][0];
+		const float g = b0 * c[0][1] + b1 * c[1][1] + b2 * c[2][1];
+		const float b = b0 * c[0][2] + b1 * c[1][2] + b2 * c[2][2];
+		color = attr.texture ? modulateColor(color, r, g, b) : packColor(r, g, b);
+	}
+	return color;
+}
+
+// one mip level for the whole triangle: texel area over pixel area.
+static float triangleLod(TRIANGLE& tri, TRI_ATTRIBS& attr) {
+	if (!attr.texture) return 0.0f;
+	V3* v = tri.points;
+	const float screen = fabs((v[1][Dim::X] - v[0][Dim::X]) * (v[2][Dim::Y] - v[0][Dim::Y])
+		- (v[1][Dim::Y] - v[0][Dim::Y]) * (v[2][Dim::X] - v[0][Dim::X]));
+	const float* uv = attr.uv;
+	const float size = (float)attr.texture->size;
+	const float texels = fabs((uv[2] - uv[0]) * (uv[5] - uv[1]) - (uv[3] - uv[1]) * (uv[4] - uv[0])) * size * size;
+	if (screen <= 0.0f || texels <= 0.0f) return 0.0f;
+	return 0.5f * log2(texels / screen);
+}
+
+// interpolated attributes, stepped incrementally along each span: one add
+// per channel (and depth, uv / depth, 1 / depth) per pixel, no per pixel
+// barycentrics. textures pick their mip level per pixel.
+void FrameBuffer::rasterTriangleShaded(TRIANGLE& tri, U32 id, TRI_ATTRIBS& attr) {
+	TRI_SETUP t;
+	if (!setupTriangleFixed(tri, 0, clip, t)) return;
+
+	// attribute planes: r, g, b, z, u / depth, v / depth, 1 / depth
+	enum { R, G, B, Z, UQ, VQ, Q, PLANES };
+	V3* v = tri.points;
+	float vals[PLANES][3];
+	for (int i = 0; i < 3; i++) {
+		vals[R][i] = attr.lit ? attr.cols[i][0] : 0.0f;
+		vals[G][i] = attr.lit ? attr.cols[i][1] : 0.0f;
+		vals[B][i] = attr.lit ? attr.cols[i][2] : 0.0f;
+		vals[Z][i] = v[i][Dim::Z];
+		vals[UQ][i] = attr.texture ? attr.uv[2 * i] * attr.q[i] : 0.0f;
+		vals[VQ][i] = attr.texture ? attr.uv[2 * i + 1] * attr.q[i] : 0.0f;
+		vals[Q][i] = attr.q[i];
+	}
+	float a0[PLANES], dx[PLANES], dy[PLANES];
+	for (int k = 0; k < PLANES; k++) {
+		attributeGradient(v, vals[k][0], vals[k][1], vals[k][2], dx[k], dy[k]);
+		// value at the box origin
+		a0[k] = vals[k][0] + dx[k] * (t.min_x - v[0][Dim::X]) + dy[k] * (t.min_y - v[0][Dim::Y]);
+	}
+	TEXTURE* texture = attr.texture;
+	const float size = texture ? (float)texture->size : 0.0f;
+
+	long long row[3] = { t.row[0], t.row[1], t.row[2] };
+	float a[PLANES];
+	for (int y = t.min_y; y <= t.max_y; y++) {
+		long long e0 = row[0], e1 = row[1], e2 = row[2];
+		for (int k = 0; k < PLANES; k++) a[k] = a0[k];
+		for (int x = t.min_x; x <= t.max_x; x++) {
+			if ((e0 | e1 | e2) >= 0) {
+				const U32 p = pixel(x, y);
+				stats.depth_tests++;
+				if (a[Z] > zb[p]) {
+					stats.depth_rejects++;
+				}
+				else {
+					zb[p] = a[Z];
+					if (VISIBILITY_BUFFER) vis[p] = id;
+					else {
+						U32 color = tri.color;
+						if (texture) {
+							const float inv_q = 1.0f / a[Q];
+							const float u = a[UQ] * inv_q, tv = a[VQ] * inv_q;
+							// uv one pixel right / down for the mip level
+							const float inv_qx = 1.0f / (a[Q] + dx[Q]);
+							const float inv_qy = 1.0f / (a[Q] + dy[Q]);
+							const float dudx = (a[UQ] + dx[UQ]) * inv_qx - u, dvdx = (a[VQ] + dx[VQ]) * inv_qx - tv;
+							const float dudy = (a[UQ] + dy[UQ]) * inv_qy - u, dvdy = (a[VQ] + dy[VQ]) * inv_qy - tv;
+							const float rho_sq = max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy) * size * size;
+							const float lod = rho_sq > 0.0f ? 0.5f * log2(rho_sq) : 0.0f;
+							stats.texture_fetches++;
+							color = texture->Sample(u * size, tv * size, lod);
+						}
+						if (attr.lit) {
+							color = texture ? modulateColor(color, a[R], a[G], a[B]) : packColor(a[R], a[G], a[B]);
+						}
+						pix[p] = color;
+					}
+				}
+			}
+			e0 += t.step_x[0];
+			e1 += t.step_x[1];
+			e2 += t.step_x[2];
+			for (int k = 0; k < PLANES; k++) a[k] += dx[k];
+		}
+		row[0] += t.step_y[0];
+		row[1] += t.step_y[1];
+		row[2] += t.step_y[2];
+		for (int k = 0; k < PLANES; k++) a0[k] += dy[k];
+	}
+}
+
+// rotated grid sample positions in 1/16 pixel units (D3D standard patterns).
+static const int MSAA_PATTERN_1[1][2] = { { 0, 0 } };
+static const int MSAA_PATTERN_2[2][2] = { { 4, 4 }, { -4, -4 } };
+static const int MSAA_PATTERN_4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+static const int MSAA_PATTERN_8[8][2] = {
+	{ 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 },
+	{ -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 }
+};
+
+static const int (*msaaPattern(int samples))[2] {
+	switch (samples) {
+		case 2: return MSAA_PATTERN_2;
+		case 4: return MSAA_PATTERN_4;
+		case 8: return MSAA_PATTERN_8;
+		default: return MSAA_PATTERN_1;
+	}
+}
+
+void FrameBuffer::setMSAA(int samples) {
+	if (samples != 2 && samples != 4 && samples != 8) samples = 1;
+	msaa = samples;
+	delete[] sample_pix;
+	delete[] sample_z;
+	sample_pix = 0;
+	sample_z = 0;
+	if (msaa == 1) return;
+	sample_pix = new U32[buf_w * buf_h * msaa];
+	sample_z = new float[buf_w * buf_h * msaa];
+}
+
+// pix / zb / vis for the current w x h, padded to whole tiles when tiled.
+void FrameBuffer::allocBuffers() {
+	buf_w = TILED_FRAMEBUFFER ? (w + TILE_SIZE - 1) & ~(TILE_SIZE - 1) : w;
+	buf_h = TILED_FRAMEBUFFER ? (h + TILE_SIZE - 1) & ~(TILE_SIZE - 1) : h;
+	if (display != pix) delete[] display;
+	delete[] pix;
+	delete[] zb;
+	delete[] vis;
+	pix = new unsigned int[buf_w * buf_h];
+	zb = new float[buf_w * buf_h];
+	vis = new U32[buf_w * buf_h];
+	display = TILED_FRAMEBUFFER ? new unsigned int[w * h] : pix;
+	clip = SCREEN_RECT(0, 0, w - 1, h - 1);
+	damage_all = true;
+	full_presents = 2;
+	setMSAA(msaa);
+}
+
+size_t FrameBuffer::memoryBytes() {
+	size_t per_pixel = sizeof(*pix) + sizeof(*zb) + sizeof(*vis);
+	if (msaa > 1) per_pixel += msaa * (sizeof(*sample_pix) + sizeof(*sample_z));
+	size_t bytes = per_pixel * buf_w * buf_h;
+	if (display != pix) bytes += sizeof(*display) * w * h;
+	return bytes;
+}
+
+// depth test + color write for the covered samples of pixel p.
+inline void FrameBuffer::writeSamples(U32 p, U32 mask, const float* z, U32 color) {
+	U32* colors = sample_pix + p * msaa;
+	float* depths = sample_z + p * msaa;
+	for (int s = 0; s < msaa; s++) {
+		if (!(mask & (1 << s))) continue;
+		stats.depth_tests++;
+		if (z[s] > depths[s]) {
+			stats.depth_rejects++;
+			continue;
+		}
+		depths[s] = z[s];
+		colors[s] = color;
+	}
+}
+
+// coverage mask + per sample depth, the color is computed once per pixel.
+void FrameBuffer::rasterTriangleMSAA(TRIANGLE& tri, TRI_ATTRIBS* attr) {
+	TRI_SETUP t;
+	if (!setupTriangleFixed(tri, 1, clip, t)) return;
+	const float lod = attr ? triangleLod(tri, *attr) : 0.0f;
+	// setup (counter clockwise) order back to the original vertex order.
+	const int i1 = t.flipped ? 2 : 1;
+	const int i2 = t.flipped ? 1 : 2;
+
+	// edge value of each sample relative to the pixel's sample point.
+	const int (*pattern)[2] = msaaPattern(msaa);
+	long long offset[3][8];
+	for (int i = 0; i < 3; i++) {
+		for (int s = 0; s < msaa; s++) {
+			offset[i][s] = -t.ey[i] * pattern[s][0] + t.ex[i] * pattern[s][1];
+		}
+	}
+
+	long long row[3] = { t.row[0], t.row[1], t.row[2] };
+	const float inv_area = 1.0f / (float)t.area;
+	float z[8];
+	for (int y = t.min_y; y <= t.max_y; y++) {
+		long long e0 = row[0], e1 = row[1], e2 = row[2];
+		for (int x = t.min_x; x <= t.max_x; x++) {
+			U32 mask = 0;
+			for (int s = 0; s < msaa; s++) {
+				const long long s0 = e0 + offset[0][s];
+				const long long s1 = e1 + offset[1][s];
+				const long long s2 = e2 + offset[2][s];
+				if ((s0 | s1 | s2) < 0) continue;
+				mask |= 1 << s;
+				z[s] = ((float)s0 * t.vz[0] + (float)s1 * t.vz[1] + (float)s2 * t.vz[2]) * inv_area;
+			}
+			if (mask) {
+				U32 color = tri.color;
+				if (attr) {
+					// once per pixel, at the pixel's sample point.
+					float b[3];
+					b[0] = (float)e0 * inv_area;
+					b[i1] = (float)e1 * inv_area;
+					b[i2] = (float)e2 * inv_area;
+					color = shadeAttribs(tri, *attr, b[0], b[1], b[2], lod);
+				}
+				writeSamples(pixel(x, y), mask, z, color);
+			}
+			e0 += t.step_x[0];
+			e1 += t.step_x[1];
+			e2 += t.step_x[2];
+		}
+		row[0] += t.step_y[0];
+		row[1] += t.step_y[1];
+		row[2] += t.step_y[2];
+	}
+}
+
+// average each pixel's samples, two samples per 64 bit load, 16 bit lanes.
+void FrameBuffer::resolveMSAA() {
+	const int shift = msaa == 8 ? 3 : msaa == 4 ? 2 : 1;
+	// layout agnostic, buf_w pixels per row (tiled: a row of whole tiles per 8).
+	parallel_for(0, buf_h, [this, shift](int lo, int hi) {
+		const __m128i zero = _mm_setzero_si128();
+		for (int p = lo * buf_w; p < hi * buf_w; p++) {
+			const U32* samples = sample_pix + p * msaa;
+			__m128i acc = zero;
+			for (int s = 0; s < msaa; s += 2) {
+				__m128i pair = _mm_loadl_epi64((const __m128i*)(samples + s));
+				acc = _mm_add_epi16(acc, _mm_unpacklo_epi8(pair, zero));
+			}
+			acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+			acc = _mm_srli_epi16(acc, shift);
+			pix[p] = (U32)_mm_cvtsi128_si32(_mm_packus_epi16(acc, zero));
+		}
+	});
+}
+
+// bbox spans less than 2 px, so at most 2x2 integer sample points can be inside.
+// all four candidates are tested at once, no box loop or incremental setup.
+void FrameBuffer::rasterSmallTriangle(TRIANGLE& tri, U32 id, TRI_ATTRIBS* attr) {
+	stats.small_triangles++;
+	if (FIXED_POINT_RASTER) {
+		rasterSmallTriangleFixed(tri, id, attr);
+		return;
+	}
+	V3* v = tri.points;
+	float ax = v[0][Dim::X], ay = v[0][Dim::Y];
+	float bx = v[1][Dim::X], by = v[1][Dim::Y];
+	float cx = v[2][Dim::X], cy = v[2][Dim::Y];
+	float za = v[0][Dim::Z], zb_ = v[1][Dim::Z], zc = v[2][Dim::Z];
+	int ib = 1, ic = 2;
+
+	// counter clockwise winding so inside = all edges non-negative.
+	float area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+	if (area == 0.0f) return;
+	if (area < 0.0f) {
+		swap(bx, cx);
+		swap(by, cy);
+		swap(zb_, zc);
+		swap(ib, ic);
+		area = -area;
+	}
+
+	const int x0 = (int)ceil(min3(ax, bx, cx));
+	const int y0 = (int)ceil(min3(ay, by, cy));
+	if (x0 > clip.x1 || y0 > clip.y1 || x0 + 1 < clip.x0 || y0 + 1 < clip.y0) return;
+
+	// lanes: (x0, y0) (x0 + 1, y0) (x0, y0 + 1) (x0 + 1, y0 + 1)
+	const __m128 px = _mm_add_ps(_mm_set1_ps((float)x0), _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f));
+	const __m128 py = _mm_add_ps(_mm_set1_ps((float)y0), _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f));
+
+	// edge i runs between the two vertices opposite vertex i.
+	const float ex[3] = { cx - bx, ax - cx, bx - ax };
+	const float ey[3] = { cy - by, ay - cy, by - ay };
+	const float ox[3] = { bx, cx, ax };
+	const float oy[3] = { by, cy, ay };
+	__m128 e[3];
+	__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (int i = 0; i < 3; i++) {
+		e[i] = _mm_sub_ps(
+			_mm_mul_ps(_mm_set1_ps(ex[i]), _mm_sub_ps(py, _mm_set1_ps(oy[i]))),
+			_mm_mul_ps(_mm_set1_ps(ey[i]), _mm_sub_ps(px, _mm_set1_ps(ox[i]))));
+		// top-left rule on unsnapped vertices, FIXED_POINT_RASTER snaps instead.
+		const bool top_left = (ey[i] > 0) || (ey[i] == 0 && ex[i] < 0);
+		const __m128 in_edge = top_left
+			? _mm_cmpge_ps(e[i], _mm_setzero_ps())
+			: _mm_cmpgt_ps(e[i], _mm_setzero_ps());
+		inside = _mm_and_ps(inside, in_edge);
+	}
+	int mask = _mm_movemask_ps(inside);
+	if (!mask) return;
+
+	// interpolated depth for all four candidates.
+	__m128 z = _mm_mul_ps(e[0], _mm_set1_ps(za));
+	z = _mm_add_ps(z, _mm_mul_ps(e[1], _mm_set1_ps(zb_)));
+	z = _mm_add_ps(z, _mm_mul_ps(e[2], _mm_set1_ps(zc)));
+	z = _mm_mul_ps(z, _mm_set1_ps(1.0f / area));
+	float z_values[4];
+	_mm_storeu_ps(z_values, z);
+	float weights[3][4];
+	const float lod = attr ? triangleLod(tri, *attr) : 0.0f;
+	if (attr) {
+		const __m128 inv_area = _mm_set1_ps(1.0f / area);
+		for (int i = 0; i < 3; i++) _mm_storeu_ps(weights[i], _mm_mul_ps(e[i], inv_area));
+	}
+
+	for (int s = 0; s < 4; s++) {
+		if (!(mask & (1 << s))) continue;
+		const int x = x0 + (s & 1);
+		const int y = y0 + (s >> 1);
+		if (x < clip.x0 || y < clip.y0 || x > clip.x1 || y > clip.y1) continue;
+		const U32 p = pixel(x, y);
+		stats.depth_tests++;
+		if (z_values[s] > zb[p]) {
+			stats.depth_rejects++;
+			continue;
+		}
+		zb[p] = z_values[s];
+		if (VISIBILITY_BUFFER) vis[p] = id;
+		else if (attr) {
+			float b[3];
+			b[0] = weights[0][s];
+			b[ib] = weights[1][s];
+			b[ic] = weights[2][s];
+			pix[p] = shadeAttribs(tri, *attr, b[0], b[1], b[2], lod);
+		}
+		else pix[p] = tri.color;
+	}
+}
+
+// snapped like the large fixed point paths (same integer edge functions and
+// top-left bias), so tiny triangles stay watertight against their neighbours.
+// the snapped box is at most 3x3 samples, walked directly.
+void FrameBuffer::rasterSmallTriangleFixed(TRIANGLE& tri, U32 id, TRI_ATTRIBS* attr) {
+	TRI_SETUP t;
+	if (!setupTriangleFixed(tri, 0, clip, t)) return;
+	const float inv_area = 1.0f / (float)t.area;
+	const float lod = attr ? triangleLod(tri, *attr) : 0.0f;
+	for (int y = t.min_y; y <= t.max_y; y++) {
+		const long long dy = (long long)(y - t.min_y);
+		for (int x = t.min_x; x <= t.max_x; x++) {
+			const long long dx = (long long)(x - t.min_x);
+			long long e[3];
+			for (int i = 0; i < 3; i++) e[i] = t.row[i] + dx * t.step_x[i] + dy * t.step_y[i];
+			if ((e[0] | e[1] | e[2]) < 0) continue;
+			const float z_value = ((float)e[0] * t.vz[0] + (float)e[1] * t.vz[1] + (float)e[2] * t.vz[2]) * inv_area;
+			const U32 p = pixel(x, y);
+			stats.depth_tests++;
+			if (z_value > zb[p]) {
+				stats.depth_rejects++;
+				continue;
+			}
+			zb[p] = z_value;
+			if (VISIBILITY_BUFFER) vis[p] = id;
+			else if (attr) {
+				// weights back in the original vertex order.
+				float b[3] = { (float)e[0] * inv_area, (float)e[1] * inv_area, (float)e[2] * inv_area };
+				if (t.flipped) swap(b[1], b[2]);
+				pix[p] = shadeAttribs(tri, *attr, b[0], b[1], b[2], lod);
+			}
+			else pix[p] = tri.color;
+		}
+	}
+}
+
+// recompute the color of the primitive that won pixel (x, y).
+U32 FrameBuffer::shadePixel(U32 id, U32 x, U32 y) {
+	const U32 i = VIS_INDEX(id);
+	switch (VIS_TYPE(id)) {
+		case VIS_SEGMENT: {
+			SEGMENT segment = compute.segment(i);
+			const U32 HALF_STROKE = segment.width >> 1;
+			const U32 HALF_STROKE_SQUARE = HALF_STROKE * HALF_STROKE;
+			V3 line_vec = segmentLineVec(segment);
+			float z_value;
+			const float dist_sq = segmentDistSq(segment, line_vec, (float)x, (float)y, z_value);
+			const float d = min(HALF_STROKE_SQUARE - dist_sq, 5.0f);
+			return segment.scaleColor(0.2f * d);
+		}
+		case VIS_SPHERE: {
+			SPHERE sphere = compute.sphere(i);
+			const U32 HALF_DOT = sphere.width >> 1;
+			const U32 HALF_DOT_SQUARE = HALF_DOT * HALF_DOT;
+			float dx = x - sphere.point[Dim::X];
+			float dy = y - sphere.point[Dim::Y];
+			const float d = min(HALF_DOT_SQUARE - (dx * dx + dy * dy), 5.0f);
+			return sphere.scaleColor(0.2f * d);
+		}
+		case VIS_TRIANGLE: {
+			return scene->geometry.triangles[i].color;
+		}
+		default: {
+			TRIANGLE tri;
+			TRI_ATTRIBS attr;
+			if (!compute.mesh_triangle(i, tri, &attr)) return tri.color;
+			// barycentric weights at the pixel
+			V3* v = tri.points;
+			const float area = (v[1][Dim::X] - v[0][Dim::X]) * (v[2][Dim::Y] - v[0][Dim::Y])
+				- (v[1][Dim::Y] - v[0][Dim::Y]) * (v[2][Dim::X] - v[0][Dim::X]);
+			if (area == 0.0f) return tri.color;
+			float b[3];
+			for (int k = 0; k < 3; k++) {
+				V3& a = v[(k + 1) % 3];
+				V3& c = v[(k + 2) % 3];
+				b[k] = ((c[Dim::X] - a[Dim::X]) * (y - a[Dim::Y]) - (c[Dim::Y] - a[Dim::Y]) * (x - a[Dim::X])) / area;
+			}
+			return shadeAttribs(tri, attr, b[0], b[1], b[2], triangleLod(tri, attr));
+		}
+	}
+}
+
+// visibility buffer pass 2: linear sweep over the id buffer, rows split across threads.
+void FrameBuffer::resolveVisibility() {
+	parallelRaster(clip.y0, clip.y1 + 1, [this](int lo, int hi) {
+		for (int y = lo; y < hi; y++) {
+			for (int x = clip.x0; x <= clip.x1; x++) {
+				const U32 p = pixel(x, y);
+				const U32 id = vis[p];
+				if (id == VIS_NONE) continue;
+				pix[p] = shadePixel(id, x, y);
+			}
+		}
+	});
+}
+
+// tiled pix -> row major display, rows of tiles split across threads. each tile row
+// is 32 contiguous bytes in and out.
+void FrameBuffer::detile() {
+	const int tiles_x = buf_w / TILE_SIZE;
+	parallel_for(0, buf_h / TILE_SIZE, [this, tiles_x](int lo, int hi) {
+		for (int ty = lo; ty < hi; ty++) {
+			const int rows = min(TILE_SIZE, h - ty * TILE_SIZE);
+			for (int tx = 0; tx < tiles_x; tx++) {
+				const U32* tile_pix = pix + (ty * tiles_x + tx) * TILE_SIZE * TILE_SIZE;
+				const int x0 = tx * TILE_SIZE;
+				if (x0 + TILE_SIZE <= w) {
+					for (int r = 0; r < rows; r++) {
+						const __m128i* src = (const __m128i*)(tile_pix + r * TILE_SIZE);
+						__m128i* dst = (__m128i*)(display + (ty * TILE_SIZE + r) * w + x0);
+						_mm_storeu_si128(dst, _mm_load_si128(src));
+						_mm_storeu_si128(dst + 1, _mm_load_si128(src + 1));
+					}
+				}
+				else {
+					// partial tile on the right edge
+					for (int r = 0; r < rows; r++) {
+						for (int c = 0; c < w - x0; c++) {
+							display[(ty * TILE_SIZE + r) * w + x0 + c] = tile_pix[r * TILE_SIZE + c];
+						}
+					}
+				}
+			}
+		}
+	});
+}
+
+// row major image (w x h) -> tiled pix.
+void FrameBuffer::tile(const unsigned int* image) {
+	parallel_for(0, h, [this, image](int lo, int hi) {
+		for (int y = lo; y < hi; y++) {
+			for (int x = 0; x < w; x++) {
+				pix[pixel(x, y)] = image[y * w + x];
+			}
+		}
+	});
+}
+
 void FrameBuffer::draw() {
-	glDrawPixels(w, h, GL_RGBA, GL_UNSIGNED_BYTE, pix);
+	// anything but renderDirty's own damage (expose, resize, redraw()) uploads
+	// the whole frame, once per buffer.
+	if (!DIRTY_RECTS || !valid() || damage() != FL_DAMAGE_USER1) full_presents = 2;
+	// the back buffer is two frames old, so last present's rows go up again.
+	SCREEN_RECT rows = present_rows;
+	if (!last_present_rows.empty()) rows = rows.empty() ? last_present_rows : rows.merge(last_present_rows);
+	last_present_rows = present_rows;
+	present_rows = SCREEN_RECT();
+
+	if (full_presents > 0) {
+		full_presents--;
+		glDrawPixels(w, h, GL_RGBA, GL_UNSIGNED_BYTE, display);
+		return;
+	}
+	// only the dirty rows. glBitmap with no image moves the raster position.
+	glBitmap(0, 0, 0.0f, 0.0f, 0.0f, (float)rows.y0, 0);
+	glDrawPixels(w, rows.y1 - rows.y0 + 1, GL_RGBA, GL_UNSIGNED_BYTE, display + rows.y0 * w);
+	glBitmap(0, 0, 0.0f, 0.0f, 0.0f, (float)-rows.y0, 0);
 }
 
 int FrameBuffer::handle(int event) {
@@ -247,7 +1458,18 @@ int FrameBuffer::handle(int event) {
 		case FL_MOVE: {
 			int u = Fl::event_x();
 			int v = Fl::event_y();
-			cerr << u << " " << v << "      \r";
+			cerr << u << " " << v;
+			if (!compute.mesh_source.empty()) {
+				// rows are stored bottom up.
+				auto t1 = chrono::high_resolution_clock::now();
+				const U32 t = compute.pick((float)u, (float)(h - 1 - v));
+				auto t2 = chrono::high_resolution_clock::now();
+				const double us = chrono::duration<double, micro>(t2 - t1).count();
+				if (t == 0xFFFFFFFF) cerr << " no mesh";
+				else cerr << " triangle " << t;
+				cerr << " (" << us << " us)";
+			}
+			cerr << "      \r";
 			break;
 		}
 		default: break;
@@ -256,42 +1478,44 @@ int FrameBuffer::handle(int event) {
 }
 
 void FrameBuffer::KeyboardHandle() {
-	int key = Fl::event_key();
-	V3& p1 = scene->player1;
-	V3& p2 = scene->player2;
-	switch (key) {
-		case FL_Left: {
-			V3 new_p1 = p1 - V3(10, 0, 0);
-			if (-200 <= new_p1[Dim::X]) p1 = new_p1;
-			scene->move_left();
+	INPUT_EVENT event;
+	event.key = Fl::event_key();
+	event.time = chrono::high_resolution_clock::now();
+	// tools run right away, game keys wait for the next simulation tick.
+	switch (event.key) {
+		case 'b': {
+			scene->RunBenchmarks();
 			break;
 		}
-		case FL_Right: {
-			V3 new_p1 = p1 + V3(10, 0, 0);
-			if (new_p1[Dim::X] <= 150) p1 = new_p1;
-			scene->move_right();
+		case 'p': {
+			scene->sim.replay_headless(INPUT_LOG_FILE);
 			break;
 		}
-		case FL_Up: {
-			V3 new_p2 = p2 - V3(10, 0, 0);
-			if (-200 <= new_p2[Dim::X]) p2 = new_p2;
+		default: {
+			// nothing drains the queue until Play starts the ticks.
+			if (!ticking) input_stats.discarded++;
+			else if (!input.push(event)) cout << "input queue full, key dropped\n";
 			break;
 		}
-		case FL_Down: {
-			scene->drop_shape();
-			V3 new_p2 = p2 + V3(10, 0, 0);
-			if (new_p2[Dim::X] <= 150) p2 = new_p2;
-			break;
-		}
-		case 'r': {
-			scene->rotate();
-		}
+	}
+}
+
+void FrameBuffer::consumeInput(vector<int>& keys) {
+	INPUT_EVENT event;
+	while (input.pop(event)) {
+		auto now = chrono::high_resolution_clock::now();
+		const double ms = chrono::duration<double, milli>(now - event.time).count();
+		input_stats.events++;
+		input_stats.total_ms += ms;
+		input_stats.max_ms = max(input_stats.max_ms, ms);
+		keys.push_back(event.key);
 	}
 }
 
 void FrameBuffer::SetBGR(unsigned int bgr) {
-	for (int uv = 0; uv < w*h; uv++)
-		pix[uv] = bgr;
+	parallel_for(0, buf_h, [this, bgr](int lo, int hi) {
+		fill(pix + lo * buf_w, pix + hi * buf_w, bgr);
+	});
 }
 
 // load a tiff image to pixel buffer
@@ -309,16 +1533,17 @@ void FrameBuffer::LoadTiff() {
 	if (w != width || h != height) {
 		w = width;
 		h = height;
-		delete[] pix;
-		pix = new unsigned int[w * h];
+		allocBuffers();
 		size(w, h);
 		glFlush();
 		glFlush();
 	}
 
-	if (TIFFReadRGBAImage(in, w, h, pix, 0) == 0) {
+	if (TIFFReadRGBAImage(in, w, h, display, 0) == 0) {
 		cout << "failed to load " << TIFF_FILE_IN << endl;
 	}
+	else if (TILED_FRAMEBUFFER) tile(display);
+	damage_all = true;
 	cout << "image read in\n";
 
 	TIFFClose(in);
@@ -341,10 +1566,17 @@ void FrameBuffer::SaveAsTiff() {
 	TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
 	TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
 	TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+	TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, h);
 
-	for (uint32 row = 0; row < (unsigned int)h; row++) {
-		TIFFWriteScanline(out, &pix[(h - row - 1) * w], row);
-	}
+	// rows flipped into one strip by row slice jobs. libtiff can't write strips
+	// from several threads, and the strip is uncompressed, so the write is one serial copy.
+	vector<unsigned int> strip((size_t)w * h);
+	parallel_for(0, h, [this, &strip](int lo, int hi) {
+		for (int row = lo; row < hi; row++) {
+			copy(display + (h - row - 1) * w, display + (h - row) * w, strip.begin() + (size_t)row * w);
+		}
+	});
+	TIFFWriteEncodedStrip(out, 0, strip.data(), (tsize_t)(strip.size() * sizeof(unsigned int)));
 
 	TIFFClose(out);
 }
\ No newline at end of file
@@ -7,22 +7,137 @@
 
 #include "V3.hpp"
 #include "Geometry.hpp"
+#include "Texture.hpp"
+#include "Shadow.hpp"
+#include "InputQueue.hpp"
+
+#define SUBPIXEL_BITS 4 // 28.4 fixed point triangle setup
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define SMALL_TRIANGLE_SPAN 2.0f // bbox side (px) below which the small triangle path is used
+#define MAX_DIRTY_RECTS 8 // more than this are merged into one
+#define TILE_SHIFT 3 // 8x8 pixel tiles when TILED_FRAMEBUFFER
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define RASTER_BAND_ROWS 32 // full frames are binned into bands of this many rows, one job per band
+
+class RENDER_STATS {
+public:
+	double sort_ms = 0.0;
+	double trace_ms = 0.0; // ray traced visibility, when ray_trace
+	double shadow_ms = 0.0; // light depth pass, 0 when the map was reused
+	double shadow_lookup_ms = 0.0; // per pixel PCF lookups
+	U32 depth_tests = 0;
+	U32 depth_rejects = 0;
+	U32 small_triangles = 0;
+	U32 texture_fetches = 0;
+	U32 dirty_rects = 0;
+	U32 dirty_pixels = 0;
+
+	float reject_rate() {
+		return depth_tests ? (float)depth_rejects / depth_tests : 0.0f;
+	}
+	// raster counters of another thread's share of the frame.
+	void addCounters(const RENDER_STATS& s) {
+		depth_tests += s.depth_tests;
+		depth_rejects += s.depth_rejects;
+		small_triangles += s.small_triangles;
+		texture_fetches += s.texture_fetches;
+	}
+};
+
+// inclusive pixel rectangle.
+class SCREEN_RECT {
+public:
+	int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+
+	SCREEN_RECT() {}
+	SCREEN_RECT(int _x0, int _y0, int _x1, int _y1) : x0(_x0), y0(_y0), x1(_x1), y1(_y1) {}
+
+	bool empty() const { return x0 > x1 || y0 > y1; }
+	int area() const { return empty() ? 0 : (x1 - x0 + 1) * (y1 - y0 + 1); }
+	bool intersects(const SCREEN_RECT& r) const {
+		return x0 <= r.x1 && r.x0 <= x1 && y0 <= r.y1 && r.y0 <= y1;
+	}
+	SCREEN_RECT intersection(const SCREEN_RECT& r) const {
+		return SCREEN_RECT(std::max(x0, r.x0), std::max(y0, r.y0), std::min(x1, r.x1), std::min(y1, r.y1));
+	}
+	SCREEN_RECT merge(const SCREEN_RECT& r) const {
+		return SCREEN_RECT(std::min(x0, r.x0), std::min(y0, r.y0), std::max(x1, r.x1), std::max(y1, r.y1));
+	}
+	bool operator==(const SCREEN_RECT& r) const {
+		return x0 == r.x0 && y0 == r.y0 && x1 == r.x1 && y1 == r.y1;
+	}
+};
 
 class FrameBuffer : public Fl_Gl_Window {
 public:
-	unsigned int *pix; // pixel array
+	unsigned int *pix; // pixel array, index with pixel(x, y)
+	float *zb; // depth per pixel
+	U32 *vis; // primitive id per pixel (visibility buffer)
+	unsigned int *display; // row major pixels for draw / tiff (pix itself unless tiled)
+	int buf_w, buf_h; // pix / zb / vis dimensions, w x h padded to whole tiles
+	static thread_local SCREEN_RECT clip; // rasterizers only touch pixels inside, the whole frame unless DIRTY_RECTS. per thread, band jobs narrow it
+	vector<SCREEN_RECT> damage_bounds; // screen bounds per primitive, last rendered frame
+	vector<U32> damage_keys; // primitive hash per primitive, last rendered frame
+	vector<SCREEN_RECT> dirty; // rects redrawn by the last renderDirty
+	SCREEN_RECT present_rows, last_present_rows; // rows draw() uploads, rows it uploaded last time
+	bool damage_all; // next renderDirty redraws everything
+	int full_presents; // draws left that upload the whole frame
+	SPSC_QUEUE<INPUT_EVENT, INPUT_QUEUE_SIZE> input; // FLTK handler -> nextFrame
+	INPUT_STATS input_stats; // since the last printStats
+	bool ticking; // nextFrame is running the simulation, game keys are queued only then
+	int msaa; // samples per pixel (1, 2, 4 or 8)
+	U32 *sample_pix; // msaa color, msaa entries per pixel
+	float *sample_z; // msaa depth, msaa entries per pixel
+	bool small_tri_path; // route tiny triangles to rasterSmallTriangle
+	bool ray_trace; // mesh visibility by ray casting the BVH instead of rasterizing
+	SHADOW_MAP* shadow; // mesh depth from scene->light_dir, SHADOW_MAPPING
 	int w, h;
 	V3 *xyz;
 	COMPUTED_GEOMETRY compute;
+	static thread_local RENDER_STATS stats; // per thread, raster jobs add theirs to the caller's
 	thread tr;
 
 	FrameBuffer(int u0, int v0, int _w, int _h);
 	
 	void draw();
+	// FLTK handler side: queue the key for the next simulation tick.
 	void KeyboardHandle();
+	// simulation side: every queued key, at the start of a tick.
+	void consumeInput(vector<int>& keys);
 	int handle(int guievent);
 	void SetBGR(unsigned int bgr);
 	void applyGeometry();
+	void rasterPrimitives(bool cull, bool meshes = true);
+	void rasterBands(bool meshes = true);
+	void rasterId(U32 id);
+	int boundsIndex(U32 id);
+	template <typename F> void parallelRaster(int begin, int end, F fn);
+	void rayTrace();
+	bool renderShadowMap();
+	void applyShadows();
+	void printStats();
+	void computeDamageBounds();
+	void addDirtyRect(SCREEN_RECT r);
+	bool renderDirty(unsigned int bgr);
+	void rasterSegment(SEGMENT& segment, U32 id);
+	void rasterSphere(SPHERE& sphere, U32 id);
+	void rasterTriangle(TRIANGLE& tri, U32 id, TRI_ATTRIBS* attr = 0);
+	void rasterTriangleFixed(TRIANGLE& tri, U32 id);
+	void rasterTriangleMSAA(TRIANGLE& tri, TRI_ATTRIBS* attr = 0);
+	void rasterSmallTriangle(TRIANGLE& tri, U32 id, TRI_ATTRIBS* attr = 0);
+	void rasterSmallTriangleFixed(TRIANGLE& tri, U32 id, TRI_ATTRIBS* attr = 0);
+	void rasterTriangleShaded(TRIANGLE& tri, U32 id, TRI_ATTRIBS& attr);
+	U32 shadeAttribs(TRIANGLE& tri, TRI_ATTRIBS& attr, float b0, float b1, float b2, float lod);
+	inline void writeSamples(U32 p, U32 mask, const float* z, U32 color);
+	void resolveMSAA();
+	inline U32 pixel(int x, int y);
+	void setMSAA(int samples);
+	void allocBuffers();
+	void detile();
+	void tile(const unsigned int* image);
+	size_t memoryBytes();
+	void resolveVisibility();
+	U32 shadePixel(U32 id, U32 x, U32 y);
 	// void nextFrame(void* window);
 	void startThread();
 
@@ -10,4 +10,9 @@ public:
 	PPC(float hfov, int _w, int _h);
 	V3 Project(V3& P);
 	V3 GetVD();
+	// re-aim at look_at from eye, keeping focal length and image size.
+	void SetPose(V3 eye, V3 look_at, V3 up);
+	// 5 planes (a, b, c, d), n . p + d >= 0 inside: 4 sides through C and
+	// neighbouring corner rays, near plane through C.
+	void GetFrustumPlanes(float* planes);
 };
\ No newline at end of file
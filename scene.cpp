@@ -1,9 +1,13 @@
+#include <fstream>
+#include <cstring>
+
 #include "Dimension.hpp"
 #include "scene.h"
 
 #include "_V3.hpp"
 #include "_M33.hpp"
 #include "_ppc.h"
+#include "RenderBenchmark.hpp"
 
 using namespace std;
 
@@ -20,14 +24,24 @@ Scene::Scene() {
 	gui = new GUI();
 	gui->show();
 
-	origin = V3((float) w * 0.5f, (float) h * 0.5f, 0.0f);
 	perspective = M33(Dim::X, 0); // M33(Dim::X, -0.1f)* M33(Dim::Y, 0.1f);
 	ppc = new PPC(hfov, w, h);
+	root = new NODE();
 
-	player1 = V3(-200, 0, 0);
-	player2 = V3(-200, 0, 0);
-	ball_pos = V3(0, 0, 0);
-	ball_vel = V3(3, 2, 0);
+	light_dir = V3(-0.4f, 0.6f, 0.7f);
+	light_dir.normalize();
+	ambient = 0.2f;
+
+	sim.start(SIM_SEED);
+	if (REPLAY_INPUT) {
+		INPUT_LOG replay;
+		if (replay.load(INPUT_LOG_FILE)) {
+			sim.start(replay.seed);
+			sim.log = replay;
+			sim.replaying = true;
+		}
+	}
+	else sim.recording = RECORD_INPUT;
 
 	// GEOMETRY SHOWCASE
 	if (SHOW_GEOMETRY) {
@@ -53,8 +67,6 @@ Scene::Scene() {
 
 	// NAME SCROLL
 	if (PLAY_NAME_SCROLL) {
-		origin = V3(0.0f, (float)h * 0.5f, 0.0f);
-
 		V3 a1[3] = {
 			V3(40, 50, 0),
 			V3(80, -50, 0),
@@ -115,13 +127,63 @@ Scene::Scene() {
 		geometry.add_triangle(TRIANGLE(n_triangle_vec3));
 	}
 
+	// MESH
+	if (SHOW_MESH) {
+		MESH* mesh = new MESH(MESH_FILE);
+		mesh->Fit(V3(0.0f, 0.0f, -400.0f), 300.0f);
+		if (TEXTURE_MAPPING) {
+			mesh->texture = new TEXTURE();
+			mesh->texture->LoadTiff(TEXTURE_FILE);
+		}
+		if (MESH_OPTIMIZE) mesh->Optimize();
+		if (MESH_LODS) mesh->BuildLods();
+		if (PACKED_MESHES) mesh->Pack();
+		geometry.add_mesh(mesh);
+	}
+
+	// INSTANCES: one shared mesh, a rotated + tinted copy per grid cell.
+	if (SHOW_INSTANCES) {
+		MESH* mesh = new MESH(INSTANCE_FILE);
+		mesh->Fit(V3(0.0f, 0.0f, 0.0f), 20.0f);
+		if (MESH_OPTIMIZE) mesh->Optimize();
+		if (MESH_LODS) mesh->BuildLods();
+		if (PACKED_MESHES) mesh->Pack();
+		for (int i = 0; i < INSTANCE_GRID; i++) {
+			for (int j = 0; j < INSTANCE_GRID; j++) {
+				const float x = -300.0f + 600.0f * j / INSTANCE_GRID;
+				const float z = -300.0f - 1200.0f * i / INSTANCE_GRID;
+				const U32 tint = COLOR(128 + (i * 37) % 128, 128 + (j * 59) % 128, 128 + ((i + j) * 23) % 128);
+				geometry.add_instance(INSTANCE(mesh, M33(Dim::Y, 0.4f * (i * INSTANCE_GRID + j)), V3(x, -80.0f, z), tint));
+			}
+		}
+	}
+
+	// STREAMED: clusters of a chunked file paged in by visibility.
+	if (SHOW_STREAMED) {
+		if (!ifstream(STREAM_FILE).good()) {
+			MESH source(STREAM_SOURCE);
+			source.Fit(V3(0.0f, -100.0f, -800.0f), 1600.0f);
+			write_chunked_mesh(source, STREAM_FILE);
+		}
+		STREAMED_MESH* stream = new STREAMED_MESH(STREAM_FILE);
+		if (stream->is_open()) geometry.streams.push_back(stream);
+		else delete stream;
+	}
+
+	// TERRAIN: quadtree chunks of a heightfield grid, built as they come into view.
+	if (SHOW_TERRAIN) {
+		MESH grid(TERRAIN_FILE);
+		TERRAIN* terrain = new TERRAIN(grid, V3(0.0f, -1000.0f, -1500.0f), 2400.0f);
+		if (terrain->is_valid()) geometry.terrain = terrain;
+		else delete terrain;
+	}
+
 	// EXTRA CREDIT: PONG
 	if (PLAY_PONG) {
 		geometry.setup_pong();
 	}
 
 	if (PLAY_TETRIS) {
-		origin = V3(120.0f, 50, 0.0f);
 		geometry.setup_tetris();
 	}
 
@@ -138,6 +200,136 @@ Scene::Scene() {
 	gui->uiw->position(u0+w+u0, v0);
 }
 
+void Scene::reset_simulation(unsigned long long seed) {
+	rng.seed(seed);
+	// the same mode order as the constructor: a later mode's origin wins.
+	origin = V3((float) w * 0.5f, (float) h * 0.5f, 0.0f);
+	if (PLAY_NAME_SCROLL) origin = V3(0.0f, (float) h * 0.5f, 0.0f);
+	if (PLAY_TETRIS) origin = V3(120.0f, 50, 0.0f);
+
+	player1 = V3(-200, 0, 0);
+	player2 = V3(-200, 0, 0);
+	ball_pos = V3(0, 0, 0);
+	ball_vel = V3(3, 2, 0);
+	prev_player1 = player1;
+	prev_player2 = player2;
+	prev_ball_pos = ball_pos;
+	s1 = 0;
+	s2 = 0;
+
+	tetris.reset();
+	tetris.high_score = 0;
+}
+
+void Scene::step(vector<int>& keys) {
+	prev_player1 = player1;
+	prev_player2 = player2;
+	prev_ball_pos = ball_pos;
+	for (int key : keys) apply_key(key);
+
+	if (PLAY_PONG) {
+		V3& p = ball_pos;
+		V3& v = ball_vel;
+
+		// wall bounce
+		if (p[Dim::X] <= -200 || p[Dim::X] >= 200) {
+			v[Dim::X] *= -1;
+		}
+
+		// player bounce
+		if (-195 <= p[Dim::Y] && p[Dim::Y] <= -190) {
+			if (player1[Dim::X] <= p[Dim::X] && p[Dim::X] <= player1[Dim::X] + 50)
+				v[Dim::Y] *= -1;
+		}
+		if (190 <= p[Dim::Y] && p[Dim::Y] <= 195) {
+			if (player2[Dim::X] <= p[Dim::X] && p[Dim::X] <= player2[Dim::X] + 50)
+				v[Dim::Y] *= -1;
+		}
+
+		// update score, the ball jumps back without interpolating.
+		if (p[Dim::Y] <= -200) {
+			s2++;
+			cout << "PLAYER 2 SCORED!\n";
+			cout << s1 << " - " << s2 << '\n';
+			ball_pos = V3(0, 0, 0);
+			prev_ball_pos = ball_pos;
+		}
+		if (p[Dim::Y] >= 200) {
+			s1++;
+			cout << "PLAYER 1 SCORED!\n";
+			cout << s1 << " - " << s2 << '\n';
+			ball_pos = V3(0, 0, 0);
+			prev_ball_pos = ball_pos;
+		}
+		p += v;
+	}
+
+	if (PLAY_NAME_SCROLL) {
+		origin += V3(3.2, 0, 0);
+		if (origin[Dim::X] > w) {
+			origin = V3(0, (float)h * 0.5f, 0.0f);
+		}
+	}
+
+	if (PLAY_TETRIS) {
+		if (tetris.shape < 0) {
+			tetris.spawn(rng.below(TETRIS_SHAPES));
+		}
+		else {
+			tetris.drop();
+		}
+	}
+}
+
+void Scene::apply_key(int key) {
+	V3& p1 = player1;
+	V3& p2 = player2;
+	switch (key) {
+		case FL_Left: {
+			V3 new_p1 = p1 - V3(10, 0, 0);
+			if (-200 <= new_p1[Dim::X]) p1 = new_p1;
+			tetris.move(-1);
+			break;
+		}
+		case FL_Right: {
+			V3 new_p1 = p1 + V3(10, 0, 0);
+			if (new_p1[Dim::X] <= 150) p1 = new_p1;
+			tetris.move(1);
+			break;
+		}
+		case FL_Up: {
+			V3 new_p2 = p2 - V3(10, 0, 0);
+			if (-200 <= new_p2[Dim::X]) p2 = new_p2;
+			break;
+		}
+		case FL_Down: {
+			tetris.drop();
+			V3 new_p2 = p2 + V3(10, 0, 0);
+			if (new_p2[Dim::X] <= 150) p2 = new_p2;
+			break;
+		}
+		case 'r': {
+			tetris.rotate();
+			break;
+		}
+	}
+}
+
+unsigned long long Scene::state_hash() {
+	unsigned long long hash = 14695981039346656037ULL;
+	auto mix = [&hash](const void* data, size_t bytes) {
+		const unsigned char* p = (const unsigned char*)data;
+		for (size_t i = 0; i < bytes; i++) hash = (hash ^ p[i]) * 1099511628211ULL;
+	};
+	V3 vectors[5] = { player1, player2, ball_pos, ball_vel, origin };
+	mix(vectors, sizeof(vectors));
+	const int counters[8] = { s1, s2, tetris.shape, tetris.rotation, tetris.row, tetris.col, tetris.score, tetris.high_score };
+	mix(counters, sizeof(counters));
+	mix(tetris.rows, sizeof(tetris.rows));
+	mix(&rng.state, sizeof(rng.state));
+	return hash;
+}
+
 void Scene::LoadTiffButton() {
 	fb->LoadTiff();
 	fb->redraw();
@@ -149,4 +341,8 @@ void Scene::SaveTiffButton() {
 
 void Scene::TranslateImage() {
 	fb->startThread();
+}
+
+void Scene::RunBenchmarks() {
+	benchmark_render(fb);
 }
\ No newline at end of file
@@ -6,11 +6,47 @@
 #include "framebuffer.h"
 #include "gui.h"
 #include "ppc.h"
+#include "SceneGraph.hpp"
+#include "Streaming.hpp"
+#include "Terrain.hpp"
+#include "Simulation.hpp"
+#include "Tetris.hpp"
 
 #define PLAY_PONG false
 #define PLAY_NAME_SCROLL false
 #define SHOW_GEOMETRY true
 #define PLAY_TETRIS false
+#define VISIBILITY_BUFFER false // rasterize depth + primitive id, then shade each pixel once
+#define FIXED_POINT_RASTER false // snap triangles to a 28.4 grid, exact integer edge tests
+#define MSAA_SAMPLES 1 // 1, 2, 4 or 8 rotated grid samples per pixel
+#define SMALL_TRIANGLE_PATH true // dedicated path for triangles under 2x2 px
+#define GOURAUD_SHADING false // lit per vertex colors interpolated across mesh triangles
+#define TEXTURE_MAPPING false // map TEXTURE_FILE onto the mesh with its .bin uvs
+#define TEXTURE_TRILINEAR true // blend two mip levels (false: bilinear on the nearest level)
+#define TILED_FRAMEBUFFER false // store color / depth in 8x8 tiles, detiled once per frame
+#define DIRTY_RECTS false // animated scenes redraw and upload only what changed since the last frame
+#define BVH_CULLING false // skip mesh triangles whose BVH leaves are outside the view frustum
+#define RAY_TRACE false // meshes by packet ray casting through the BVH on all cores (MSAA_SAMPLES 1)
+#define SHADOW_MAPPING false // mesh shadows from a depth only pass at the light, PCF lookups (MSAA_SAMPLES 1)
+#define SORT_PRIMITIVES false // draw primitives front to back by projected min depth
+#define PRINT_RENDER_STATS false // print per frame render stats to the terminal
+#define MESH_OPTIMIZE false // reorder loaded mesh triangles / vertices for vertex cache and memory locality
+#define MESH_LODS false // QEM simplified lods per loaded mesh, picked per mesh / instance by projected error
+#define PACKED_MESHES false // 16 bit positions, octahedral normals, 8 bit colors, delta indices, decoded while projecting
+#define SHOW_MESH false
+#define MESH_FILE "geometry/bunny.bin" // mesh shown when SHOW_MESH
+#define TEXTURE_FILE "2d_graphics.tif" // mesh texture when TEXTURE_MAPPING
+#define SHOW_INSTANCES false
+#define INSTANCE_FILE "geometry/teapot1K.bin" // mesh instanced on a grid when SHOW_INSTANCES
+#define INSTANCE_GRID 32 // INSTANCE_GRID x INSTANCE_GRID instances
+#define SHOW_STREAMED false
+#define STREAM_FILE "geometry/terrain.chunks" // chunked mesh streamed when SHOW_STREAMED
+#define STREAM_SOURCE "geometry/terrain.bin" // converted to STREAM_FILE when that is missing
+#define SHOW_TERRAIN false
+#define TERRAIN_FILE "geometry/terrain.bin" // heightfield grid drawn when SHOW_TERRAIN
+#define RECORD_INPUT false // log the session's keys to INPUT_LOG_FILE for replay
+#define REPLAY_INPUT false // drive the session from INPUT_LOG_FILE instead of the keyboard
+#define INPUT_LOG_FILE "session.input"
 #define TIFF_FILE_IN "name.tif" // what we read from
 #define TIFF_FILE_OUT "random.tif" // what we write to
 
@@ -27,167 +63,39 @@ public:
 	M33 perspective;
 	V3 origin;
 	GEOMETRY geometry;
+	NODE* root; // transform hierarchy, primitives attach with GEOMETRY::attach
+
+	// directional light (unit vector towards the light)
+	V3 light_dir;
+	float ambient;
+
+	// fixed timestep games, everything random comes from rng.
+	SIMULATION sim;
+	RNG rng;
 
 	// pong stuff
 	V3 player1;
 	V3 player2;
 	V3 ball_pos;
 	V3 ball_vel;
+	V3 prev_player1, prev_player2, prev_ball_pos; // at the previous tick, for interpolation
 	int s1 = 0, s2 = 0;
 
 	// tetris stuff :|
-	bool grid[20][10];
-	bool shapes[3][3][3] = {
-		{
-			{ 0, 1, 0 },
-			{ 1, 1, 1 },
-			{ 0, 0, 1 }
-		},
-		{
-			{ 0, 1, 0 },
-			{ 1, 1, 0 },
-			{ 0, 1, 0 }
-		},
-		{
-			{ 0, 1, 0 },
-			{ 1, 1, 0 },
-			{ 0, 1, 0 }
-		}
-	};
-	int curr_shape = -1;
-	pair<int, int> pos = { 17, 0 };
-	int score = 0;
-	int high_score = 0;
-
-	void check_and_remove_lines() {
-		for (int r = 0; r < 20; r++) {
-			bool is_line = true;
-			for (int c = 0; c < 10; c++) {
-				if (!grid[r][c]) {
-					is_line = false;
-					break;
-				}
-			}
-			if (is_line) {
-				inc_score();
-				for (int i = r + 1; i < 20; i++) {
-					for (int j = 0; j < 10; j++) {
-						grid[i - 1][j] = grid[i][j];
-					}
-				}
-			}
-		}
-	}
-
-	void inc_score() {
-		score++;
-		if (high_score > score) high_score = score;
-	}
-
-	void add_shape() {
-		int shape_num = (rand() ^ rand()) % 3;
-		for (int c = 0; c < 10; c++) {
-			bool fits = will_fit({ 0, c }, shape_num);
-			if (fits) {
-				curr_shape = shape_num;
-				pos = { 17, c };
-				return;
-			}
-		}
-		// END GAME.
-		reset();
-	}
-
-	void reset() {
-		score = 0;
-		for (int r = 0; r < 20; r++) {
-			for (int c = 0; c < 10; c++) {
-				grid[r][c] = 0;
-			}
- 		}
-		pos = { 0, 19 };
-	}
-
-	void drop_shape() {
-		pair<int, int> new_pos = { pos.first - 1, pos.second };
-		if (will_fit(new_pos, curr_shape)) {
-			pos = new_pos;
-		}
-		else {
-			place_shape();
-		}
-	}
-
-	void place_shape() {
-		for (int i = 0; i < 3; i++) {
-			for (int j = 0; j < 3; j++) {
-				int r = pos.first + i;
-				int c = pos.second + j;
-				if (shapes[curr_shape][i][j])
-					grid[r][c] = shapes[curr_shape][i][j];
-			}
-		}
-		curr_shape = -1;
-	}
-
-	bool will_fit(pair<int, int> p, int shape_num) {
-		for (int i = 0; i < 3; i++) {
-			for (int j = 0; j < 3; j++) {
-				if (shapes[shape_num][i][j]) {
-					int r = p.first + i;
-					int c = p.second + j;
-					if (c < 0 || c > 9) return false; // out of bounds bit
-					if (r < 0) return false;
-					if (grid[r][c]) return false; // already a 1 there
-				}
-			}
-		}
-		return true;
-	}
-
-	void rotate() {
-		clock();
-		if (will_fit(pos, curr_shape)) {
-			return;
-		}
-		clock();
-		clock();
-		clock();
-	}
-
-	void clock() {
-		bool(&shape)[3][3] = shapes[curr_shape];
-		int temp = shape[0][0];
-		shape[0][0] = shape[0][2];
-		shape[0][2] = shape[2][2];
-		shape[2][2] = shape[2][0];
-		shape[2][0] = temp;
-
-		temp = shape[0][1];
-		shape[0][1] = shape[1][2];
-		shape[1][2] = shape[2][1];
-		shape[2][1] = shape[1][0];
-		shape[1][0] = temp;
-	}
-	
-	void move_left() {
-		pair<int, int> new_pos = { pos.first, pos.second - 1 };
-		if (will_fit(new_pos, curr_shape)) {
-			pos = new_pos;
-		}
-	}
-	void move_right() {
-		pair<int, int> new_pos = { pos.first, pos.second + 1 };
-		if (will_fit(new_pos, curr_shape)) {
-			pos = new_pos;
-		}
-	}
-
+	TETRIS tetris;
 
 	Scene();
+	// games back to their starting state, rng seeded with seed.
+	void reset_simulation(unsigned long long seed);
+	// one fixed tick: keys first, then pong / name scroll / tetris.
+	void step(vector<int>& keys);
+	void apply_key(int key);
+	// FNV-1a over everything step changes.
+	unsigned long long state_hash();
 	void LoadTiffButton();
 	void SaveTiffButton();
 	void TranslateImage();
+	void RunBenchmarks();
 };
 
 extern Scene *scene;
\ No newline at end of file